@@ -20,6 +20,10 @@
  *       Changed file naming convention to reflect generic time periods
  *       instead of days, and removed day fraction.
  *       Example:  prc_2004_6358.asc
+ *
+ *    Modification, October 2026:
+ *       The grid to write is passed in, so that kriging variance grids
+ *       can be written as well.  Example:  prc_var_2004_6358.asc
  */
 
 #include <stdio.h>
@@ -27,15 +31,17 @@
 
 #include "dk_x.h"
 
-void arcout(iy, ip)
+void arcout(iy, ip, g, kv)
 int iy;                          /* year */
 int ip;                          /* period (sequential number beginning Oct 1) */
+float *g;                        /* grid values */
+int kv;                          /* 1 = kriging variance grid */
 {
    char buf[6];                  /* buffer for file name building */
    FILE *fparc;                  /* output file pointer */
    int i, j;                     /* loop indexes */
    int k;                        /* grid value counter */
-   char outfile[21];             /* output file name */
+   char outfile[25];             /* output file name */
 
    /* Build output file name and open file */
 
@@ -47,6 +53,8 @@ int ip;                          /* period (sequential number beginning Oct 1) *
       strcpy(outfile, "swe_");
    else
       strcpy(outfile, "dat_");
+   if (kv == 1)
+      strcat(outfile, "var_");
    sprintf(buf, "%04d_", iy);
    strcat(outfile, buf);
    sprintf(buf, "%04d", (ip+1));
@@ -76,11 +84,11 @@ int ip;                          /* period (sequential number beginning Oct 1) *
          k++;
          if (grid[k].use == 1) {
             if (igridpr == 1)
-               fprintf(fparc, "%.1f ", gprec[k]);
+               fprintf(fparc, "%.1f ", g[k]);
             else if (igridpr == 2)
-               fprintf(fparc, "%.0f ", gprec[k]);
+               fprintf(fparc, "%.0f ", g[k]);
             else if (igridpr == 3)
-               fprintf(fparc, "%.0f ", (gprec[k]*10));
+               fprintf(fparc, "%.0f ", (g[k]*10));
          }
          else
             fprintf(fparc, "%.0f ", (arc.nodata-0.1));
@@ -2,6 +2,8 @@
 #include <stdlib.h>
 #include <malloc/malloc.h>
 
+#define AALIGN 64                /* alignment of avector() (bytes) */
+
 /*
  *    vector.c
  *
@@ -29,6 +31,28 @@ int n;
    return(v);
 }
 
+/*
+ *    avector.c
+ *
+ *    Allocate a float vector with n elements, aligned to 64 bytes.  n is
+ *    a size_t, for vectors too long to count in an int; callers must
+ *    pass it as one.
+ */
+
+float *avector(n)
+size_t n;
+{
+   float *v = (float *) NULL;
+
+   if (n == 0 || posix_memalign((void **) &v, AALIGN, n * sizeof(float)) != 0)
+      v = (float *) NULL;
+   if (!v) {
+      printf("\n\nAllocation failure in avector().\n");
+      exit(0);
+   }
+   return(v);
+}
+
 /*
  *    dvector.c
  *
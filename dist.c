@@ -5,11 +5,17 @@
  *
  *    Compute distances (kilometers) between stations
  *    based on latitude and longitude
+ *
+ *    Modification, October 2026:
+ *       The lengths of a degree are looked up in the tables by index
+ *       (dist_ll_len()) instead of by a search through them
  */
 
 #include <math.h>
 #include <stdio.h>
 
+#include "dk_x.h"
+
 #define ABS(a) ((a) >= 0 ? (a) : -(a))      /* absolute value operator */
 
 /* Debug
@@ -18,39 +24,86 @@ extern FILE *fpout;
 
 double sqrt();                   /* square root function */
 
+struct lldata {
+   float deg;                    /* degrees */
+   float len;                    /* length */
+};
+static struct lldata latd[28] = {
+   {25.5f, 8.833f}, {26.5f, 8.842f}, {27.5f, 8.852f}, {28.5f, 8.862f},
+   {29.5f, 8.873f}, {30.5f, 8.883f}, {31.5f, 8.894f}, {32.5f, 8.905f},
+   {33.5f, 8.916f}, {34.5f, 8.928f}, {35.5f, 8.939f}, {36.5f, 8.951f},
+   {37.5f, 8.962f}, {38.5f, 8.974f}, {39.5f, 8.986f}, {40.5f, 8.998f},
+   {41.5f, 9.011f}, {42.5f, 9.023f}, {43.5f, 9.035f}, {44.5f, 9.047f},
+   {45.5f, 9.060f}, {46.5f, 9.072f}, {47.5f, 9.084f}, {48.5f, 9.096f},
+   {49.5f, 9.108f}, {50.5f, 9.121f}, {51.5f, 9.133f}, {52.5f, 9.145f},
+};                               /* latitude and length of one degree of
+                                    latitude (statute miles) */
+static struct lldata longd[28] = {
+   {25.0f, 2.729f}, {26.0f, 2.212f}, {27.0f, 1.676f}, {28.0f, 1.122f},
+   {29.0f, 0.548f}, {30.0f, 9.956f}, {31.0f, 9.345f}, {32.0f, 8.716f},
+   {33.0f, 8.071f}, {34.0f, 7.407f}, {35.0f, 6.725f}, {36.0f, 6.027f},
+   {37.0f, 5.311f}, {38.0f, 4.579f}, {39.0f, 3.829f}, {40.0f, 3.063f},
+   {41.0f, 2.281f}, {42.0f, 1.483f}, {43.0f, 0.669f}, {44.0f, 9.840f},
+   {45.0f, 8.995f}, {46.0f, 8.136f}, {47.0f, 7.261f}, {48.0f, 6.372f},
+   {49.0f, 5.469f}, {50.0f, 4.552f}, {51.0f, 3.621f}, {52.0f, 2.676f},
+};                               /* latitude and length of one degree of
+                                    longitude (statute miles ) */
+
+/*
+ *    Lengths (statute miles) of one degree of latitude and of longitude
+ *    at latitude lat, interpolated in the tables.  The degrees in each
+ *    table are one apart, so the interval holding lat follows from its
+ *    integer part (where lat is on the boundary of two intervals, the
+ *    upper one, as the search through the tables gave).  Latitudes
+ *    outside a table take the length at its nearer end, so that every
+ *    length is within the range of the table, as dist_ll_scale()
+ *    assumes.
+ */
+
+void dist_ll_len(lat, latlen, longlen)
+float lat;                       /* decimal latitude */
+float *latlen;                   /* length of one degree of latitude */
+float *longlen;                  /* length of one degree of longitude */
+{
+   int i, ip1;                   /* array indexes */
+
+   if (lat < latd[0].deg)
+      *latlen = latd[0].len;
+   else if (lat > latd[27].deg)
+      *latlen = latd[27].len;
+   else {
+      i = (int) (lat - latd[0].deg);
+      if (i > 26)
+         i = 26;
+      ip1 = i + 1;
+      *latlen = (float) ((lat - latd[i].deg) / (latd[ip1].deg - latd[i].deg))
+                * (latd[ip1].len - latd[i].len) + latd[i].len;
+   }
+
+   if (lat < longd[0].deg)
+      *longlen = longd[0].len;
+   else if (lat > longd[27].deg)
+      *longlen = longd[27].len;
+   else {
+      i = (int) (lat - longd[0].deg);
+      if (i > 26)
+         i = 26;
+      ip1 = i + 1;
+      *longlen = (float) (((lat - longd[i].deg) /
+                 (longd[ip1].deg - longd[i].deg))
+                 * (longd[ip1].len - longd[i].len) + longd[i].len);
+   }
+}
+
 float dist_ll(lat1, long1, lat2, long2, ewdst, nsdst)
 float lat1, long1, lat2, long2;  /* decimal latitude and longitude for
                                     two stations */
 float *ewdst;                    /* east-west distance */
 float *nsdst;                    /* north-south distance */
 {
-   int i, ip1;                   /* array indexes */
    float len1, len2;             /* lengths */
    float lenavg;                 /* average length */
-   struct lldata {
-      float deg;                 /* degrees */
-      float len;                 /* length */
-   };
-   struct lldata latd[28] = {
-      {25.5f, 8.833f}, {26.5f, 8.842f}, {27.5f, 8.852f}, {28.5f, 8.862f},
-      {29.5f, 8.873f}, {30.5f, 8.883f}, {31.5f, 8.894f}, {32.5f, 8.905f},
-      {33.5f, 8.916f}, {34.5f, 8.928f}, {35.5f, 8.939f}, {36.5f, 8.951f},
-      {37.5f, 8.962f}, {38.5f, 8.974f}, {39.5f, 8.986f}, {40.5f, 8.998f},
-      {41.5f, 9.011f}, {42.5f, 9.023f}, {43.5f, 9.035f}, {44.5f, 9.047f},
-      {45.5f, 9.060f}, {46.5f, 9.072f}, {47.5f, 9.084f}, {48.5f, 9.096f},
-      {49.5f, 9.108f}, {50.5f, 9.121f}, {51.5f, 9.133f}, {52.5f, 9.145f},
-   };                            /* latitude and length of one degree of
-                                    latitude (statute miles) */
-   struct lldata longd[28] = {
-      {25.0f, 2.729f}, {26.0f, 2.212f}, {27.0f, 1.676f}, {28.0f, 1.122f},
-      {29.0f, 0.548f}, {30.0f, 9.956f}, {31.0f, 9.345f}, {32.0f, 8.716f},
-      {33.0f, 8.071f}, {34.0f, 7.407f}, {35.0f, 6.725f}, {36.0f, 6.027f},
-      {37.0f, 5.311f}, {38.0f, 4.579f}, {39.0f, 3.829f}, {40.0f, 3.063f},
-      {41.0f, 2.281f}, {42.0f, 1.483f}, {43.0f, 0.669f}, {44.0f, 9.840f},
-      {45.0f, 8.995f}, {46.0f, 8.136f}, {47.0f, 7.261f}, {48.0f, 6.372f},
-      {49.0f, 5.469f}, {50.0f, 4.552f}, {51.0f, 3.621f}, {52.0f, 2.676f},
-   };                            /* latitude and length of one degree of
-                                    longitude (statute miles ) */
+   float lng1, lng2;             /* lengths for east-west distance */
 /* Debug
 fprintf(fpout, "\n\ndist:  lat1=%5.2f  long1=%6.2f  lat2=%5.2f  long2=%6.2f",
         lat1, long1, lat2, long2);
@@ -58,15 +111,8 @@ fprintf(fpout, "\n\ndist:  lat1=%5.2f  long1=%6.2f  lat2=%5.2f  long2=%6.2f",
 
    /* Compute north-south distance between stations (km) */
 
-   for (i = 0; i < 27; i++) {
-      ip1 = i + 1;
-      if (lat1 >= latd[i].deg && lat1 <= latd[ip1].deg)
-         len1 = (float) ((lat1 - latd[i].deg) / (latd[ip1].deg - latd[i].deg))
-                * (latd[ip1].len - latd[i].len) + latd[i].len;
-      if (lat2 >= latd[i].deg && lat2 <= latd[ip1].deg)
-         len2 = (float) ((lat2 - latd[i].deg) / (latd[ip1].deg - latd[i].deg))
-                * (latd[ip1].len - latd[i].len) + latd[i].len;
-   }
+   dist_ll_len(lat1, &len1, &lng1);
+   dist_ll_len(lat2, &len2, &lng2);
    lenavg = (float) (1.609 * ((len1 + len2) / 2));
    *nsdst = (float) (ABS(lat1 - lat2) * lenavg);
 /* Debug
@@ -76,16 +122,7 @@ fprintf(fpout, "\n       nsdst=%5.2f  len1=%5.2f  len2=%5.2f  lenavg=%5.2f",
 
    /* Compute east-west distance between stations */
 
-   for (i = 0; i < 27; i++) {
-      ip1 = i + 1;
-      if (lat1 >= longd[i].deg && lat1 <= longd[ip1].deg)
-         len1 = (float) (((lat1 - longd[i].deg) / (longd[ip1].deg - longd[i].deg))
-                * (longd[ip1].len - longd[i].len) + longd[i].len);
-      if (lat2 >= longd[i].deg && lat2 <= longd[ip1].deg)
-         len2 = (float) (((lat2 - longd[i].deg) / (longd[ip1].deg - longd[i].deg))
-                * (longd[ip1].len - longd[i].len) + longd[i].len);
-   }
-   lenavg = (float) (1.609 * ((len1 + len2) / 2));
+   lenavg = (float) (1.609 * ((lng1 + lng2) / 2));
    *ewdst = (float) (ABS(long1 - long2) * lenavg);
 /* Debug
 fprintf(fpout, "\n       ewdst=%5.2f  len1=%5.2f  len2=%5.2f  lenavg=%5.2f",
@@ -98,6 +135,34 @@ fprintf(fpout, "\n       ewdst=%5.2f  len1=%5.2f  len2=%5.2f  lenavg=%5.2f",
    return((float) sqrt((double) (*nsdst * *nsdst + *ewdst * *ewdst)));
 }
 
+/*
+ *    dist_ll_scale.c
+ *
+ *    Return the smallest number of kilometers per degree of latitude and
+ *    of longitude that dist_ll() uses anywhere in its tables.  Multiplied
+ *    by a difference in latitude or longitude, these give a lower bound
+ *    on the distance computed by dist_ll(), since dist_ll_len() keeps
+ *    every length within the range of its table.
+ */
+
+void dist_ll_scale(kmlat, kmlong)
+float *kmlat;                    /* minimum km per degree of latitude */
+float *kmlong;                   /* minimum km per degree of longitude */
+{
+   int i;                        /* array index */
+
+   *kmlat = latd[0].len;
+   *kmlong = longd[0].len;
+   for (i = 1; i < 28; i++) {
+      if (latd[i].len < *kmlat)
+         *kmlat = latd[i].len;
+      if (longd[i].len < *kmlong)
+         *kmlong = longd[i].len;
+   }
+   *kmlat = (float) (1.609 * *kmlat);
+   *kmlong = (float) (1.609 * *kmlong);
+}
+
 /*
  *    dist_en.c
  *
@@ -120,3 +185,117 @@ float north1, east1, north2, east2;    /* northings and eastings for two
    return (float) ((sqrt((double) (nsdst * nsdst + ewdst * ewdst)) / 1000));
 }
 
+/*
+ *    dist_grid.c
+ *
+ *    Compute distances (km) between grid cells and stations as they are
+ *    needed, instead of keeping a matrix of them for every grid cell
+ *    and station.  Grid cell coordinates (for ARC/INFO and GRASS grids,
+ *    the cell centers from the raster header, set by readgrid()) and
+ *    station coordinates are those of the grid and sta structures.
+ *
+ *    dist_grid_row() computes the distances from one grid cell to many
+ *    stations in one loop that the compiler vectorizes (see SIMD_OPTIONS
+ *    in makefile); it is called from within the parallel loops of the
+ *    weight engine.  The station coordinates, and for latitude and
+ *    longitude the lengths of a degree at each station, are copied into
+ *    separate vectors by dist_grid_init() for it, and the lengths of a
+ *    degree at the grid cell are found once for the row.  Results are
+ *    the same as those of dist_ll() and dist_en().
+ */
+
+static float *dgnorth = NULL;    /* northings (latitudes) of stations */
+static float *dgeast;            /* eastings (longitudes) of stations */
+static float *dglat;             /* lengths of a degree of latitude at
+                                    stations (for lat. and long.) */
+static float *dglong;            /* lengths of a degree of longitude at
+                                    stations (for lat. and long.) */
+
+/*
+ *    Set up the station vectors for dist_grid_row()
+ */
+
+void dist_grid_init()
+{
+   int m;                        /* station index */
+
+   dgnorth = vector(nsta);
+   dgeast = vector(nsta);
+   dglat = vector(nsta);
+   dglong = vector(nsta);
+   for (m = 0; m < nsta; m++) {
+      dgnorth[m] = sta[m].north;
+      dgeast[m] = sta[m].east;
+      if (icoord == 1)
+         dist_ll_len(sta[m].north, &dglat[m], &dglong[m]);
+      else
+         dglat[m] = dglong[m] = 0;
+   }
+}
+
+/*
+ *    Distance between grid cell l and station m
+ */
+
+float dist_grid(l, m)
+int l;                           /* grid index */
+int m;                           /* station index */
+{
+   float ewdist, nsdist;         /* east-west and north-south distances
+                                    from dist_ll() (not used here) */
+
+   if (icoord == 1)
+      return(dist_ll(grid[l].north, grid[l].east, sta[m].north,
+                     sta[m].east, &ewdist, &nsdist));
+   return(dist_en(grid[l].north, grid[l].east, sta[m].north, sta[m].east));
+}
+
+/*
+ *    Distances between grid cell l and stations idx[0..n-1] (NULL = the
+ *    first n stations), into d[0], d[inc], d[2*inc], ...
+ */
+
+void dist_grid_row(l, idx, n, d, inc)
+int l;                           /* grid index */
+int *idx;                        /* indexes of stations (NULL = 0..n-1) */
+int n;                           /* number of stations */
+double *d;                       /* distances */
+int inc;                         /* spacing of distances in d */
+{
+   float east, north;            /* coordinates of grid cell */
+   float ewdst, nsdst;           /* east-west and north-south distances */
+   int i, m;                     /* loop index and station index */
+   float latlen, longlen;        /* lengths of a degree at grid cell */
+
+   east = grid[l].east;
+   north = grid[l].north;
+
+   /* Latitude and longitude: dist_ll() */
+
+   if (icoord == 1) {
+      dist_ll_len(north, &latlen, &longlen);
+#pragma omp simd private(ewdst, m, nsdst)
+      for (i = 0; i < n; i++) {
+         m = (idx != NULL) ? idx[i] : i;
+         nsdst = (float) (ABS(north - dgnorth[m]) *
+                 (float) (1.609 * ((latlen + dglat[m]) / 2)));
+         ewdst = (float) (ABS(east - dgeast[m]) *
+                 (float) (1.609 * ((longlen + dglong[m]) / 2)));
+         d[(size_t) i * inc] = (float) sqrt((double) (nsdst * nsdst +
+                                            ewdst * ewdst));
+      }
+   }
+
+   /* Easting and northing: dist_en() */
+
+   else {
+#pragma omp simd private(ewdst, m, nsdst)
+      for (i = 0; i < n; i++) {
+         m = (idx != NULL) ? idx[i] : i;
+         ewdst = (float) (ABS(east - dgeast[m]));
+         nsdst = (float) (ABS(north - dgnorth[m]));
+         d[(size_t) i * inc] = (float) ((sqrt((double) (nsdst * nsdst +
+                                       ewdst * ewdst)) / 1000));
+      }
+   }
+}
@@ -65,7 +65,13 @@
  *       -i or /i    gives printout of input data
  *       -o or /o    reads data in OMS-compatible csv format
  *       -r or /r    gives printout of detrended residuals
+ *       -t or /t    number of threads for calculating kriging weights
+ *                   and kriging timesteps (follows the -t; default 1);
+ *                   time spent by each thread on kriging weights is
+ *                   written to output file
  *       -w or /w    gives printout of kriging weights
+ *       -x or /x    writes leave-one-out cross-validation errors of the
+ *                   detrended residuals to output file then quits
  *       -k or /k    reads all program info from a configuration file
  *                   (the name of which follows the -k)
  *
@@ -242,6 +248,8 @@ struct {
 } arc;
 void arcout();                   /* function to write out daily grids in
                                     ARC/INFO format */
+float *avector();                /* aligned float vector space allocation
+                                    function */
 float **b0, **b1;                /* matrices of regression intercepts
                                     and slopes */
 float **b02, **b12;              /* matrices of intercepts and slopes for line
@@ -252,10 +260,12 @@ char dataname[21];               /* name of data type in csv input file
                                     (precip, tmax, or tmin) */
 /* int dayfrac;                     day fraction of data
                                     (beginning of time period) */
-float **dgrid;                   /* matrix of distances between grid cells
-                                    and prec/temp stations */
 float dist_en();                 /* function to calculate distances between
                                     stations based on eastings and northings */
+float dist_grid();               /* function to calculate distance between
+                                    a grid cell and a station */
+void dist_grid_init();           /* function to set up station vectors for
+                                    distances from grid cells */
 float dist_ll();                 /* function to calculate distances between
                                     stations based on latitude and longitude */
 double **dmatrix();              /* double matrix space allocation function */
@@ -278,8 +288,6 @@ FILE *fpout;                     /* pointer to main output file */
 FILE *fpzone;                    /* pointer to zone output file */
 FILE *fpkw;                      /* pointer to kriging weight file */
 int getln();                     /* function to read line from file */
-float *gprec;                    /* vector of precip at grid cells for
-                                    one day */
 struct {
 	double north;                 /* northernmost extent of GRASS raster */
 	double south;                 /* southernmost extent of GRASS raster */
@@ -312,8 +320,6 @@ int igridpr;                     /* flag for precision of values in GRASS or
 int imask;                       /* flag indicating if watershed mask is to be
                                     used for calculating spatial averages */
 int **imatrix();                 /* int matrix space allocation function */ 
-int imiss;                       /* flag to indicate if one or more stations
-                                    have missing data */
 int iout = 0;                    /* output format (1 = tabular,
                                     2 = GRASS+tabular, 3 = ARC/INFO+tabular,
                                     4 = IPW+tabular) */
@@ -325,14 +331,53 @@ int irmeth;                      /* regression method flag:
                                     2 = least absolute deviations */
 int **iswehz;                    /* index of station with highest zero swe */
 int **isweln;                    /* index of station with lowest nonzero swe */
+int *iuse;                       /* vector of indexes of used grid cells */
+int ivar = 0;                    /* 1 = write kriging variance grids */
 int *ivector();                  /* int vector space allocation function */
+int isolv = 2;                   /* kriging system solver (1 = LU
+                                    decomposition, 2 = symmetric, 3 =
+                                    symmetric checked against LU, 4 =
+                                    symmetric in mixed precision) */
+int iwarm = 0;                   /* 1 = elimination of stations with negative
+                                    weights starts from the stations left at
+                                    the previous grid cell */
+int iweng = 2;                   /* kriging weight engine (1 = solve each
+                                    grid cell separately, 2 = factor station
+                                    matrix once for all grid cells,
+                                    3 = closed form from inverse of station
+                                    distance matrix) */
 int iwt;                         /* station weighting flag (1 = distance
                                     weighting; 2 = equal weighting) */
 int izero;                       /* flag indicating a day where all stations
                                     have zero precipitation (izero = 1) */
 int izone;                       /* flag indicating if zones (such as hydrologic 
                                     response units) are to be defined */
+float kfcmb = 64;                /* memory limit of kriging factorization
+                                    cache (MB) */
+float *kresid = NULL;            /* largest relative residual of kriging
+                                    equations for each grid cell
+                                    (kriging-solver = 4) */
 double *krige();                    /* kriging function */
+double krige_var();              /* function to compute kriging variance */
+void kweng();                    /* kriging weight engine */
+void kweng_report();             /* function to write out time spent by
+                                    each thread on kriging weights */
+void ldlcheck_report();          /* function to write out solver check */
+void ldlresid_report();          /* function to write out residuals of
+                                    mixed-precision solver */
+void kwcache_report();           /* function to write out weight cache
+                                    statistics */
+void kfcache_init();             /* function to initialize factorization
+                                    cache */
+void kfcache_report();           /* function to write out factorization
+                                    cache statistics */
+float kwcmb = 256;               /* memory limit of kriging weight cache (MB) */
+char kwdir[150] = "";            /* directory of kriging weight files kept
+                                    between runs (blank = none) */
+int kwstore_load();              /* function to read kriging weights kept
+                                    from an earlier run */
+void kwstore_save();             /* function to keep kriging weights for
+                                    later runs */
 int *lastday;                    /* vector of last day (period) of data for each year */
 int len;                         /* string length */
 char line[501];                  /* input line buffer */
@@ -373,14 +418,24 @@ int ret;                         /* function return code */
 int roundVal = -99;		 		 /* number of decimal place to round to 10^roundVal */
 double se;                       /* standard error */
 float **snolin;                  /* snowline */
+float srad = -99;                /* search radius (km) for stations used in
+                                    kriging each grid cell (< 0 = none) */
+int sradmax = -99;               /* maximum number of stations within search
+                                    radius (< 0 = no limit) */
+int sradmin = 3;                 /* minimum number of stations for search
+                                    radius (nearest stations are used if
+                                    fewer are within the radius) */
 int sreg();                      /* simple linear regression function */
+void staidx_build();             /* function to build spatial index of
+                                    stations */
 struct stations {
 	char id[26];                  /* station identifier */
 	float elev;                   /* elevation (thousands) */
 	float east;                   /* easting (or longitude) of station */
 	float north;                  /* northing (or latitude) of station */
-	float **data;                 /* data matrix */
 } sta[MSTA];
+float *stdata;                   /* station data, the stations of each time
+                                    step together (see DATA() in dk_m.h) */
 //int *staflg;                     /* station use flags */
 struct {
 	int dstart;                   /* index of starting day of storm */
@@ -393,6 +448,8 @@ int type;                        /* data type (1 = prec, 2 = temp, 3 = swe,
 float *vector();                 /* float vector space allocation function */
 double *w;                       /* kriging weights */
 float **wall;                    /* kriging weight matrix for all stations */
+float *wvar = NULL;              /* kriging variance at grid cells for
+                                    weights of all stations */
 double *x, *y;                   /* regression data vectors */
 float *xd, *yd;		/* data grid vectors */
 int *year;                       /* years of data */
@@ -417,6 +474,7 @@ int iprintresiduals = 0;
 int iprintweights = 0;
 int i_input_to_output = 0;
 int ioutputdir = 0;
+int ixval = 0;
 int nthreads = 1;
 int use_config_file = 0;
 int ikwfile = 0;
@@ -455,6 +513,8 @@ char *argv[];
 	void storm2();                /* MAP calculation function for storms */
 	void swe1();                  /* swe vs. elevation calculation function */
 	void swe2();                  /* MASWE calculation function */
+	float *wblock;                /* space for the rows of wall */
+	void xvalid();                /* cross-validation function */
 
 
 	/* First, evaluate command-line options and set flags accordingly */
@@ -475,11 +535,17 @@ char *argv[];
 				iprintweights = 1;
 			else if (strcmp(argv[i], "-c") == 0 || strcmp(argv[i], "/c") == 0)
 				i_input_to_output = 1;
+			else if (strcmp(argv[i], "-x") == 0 || strcmp(argv[i], "/x") == 0)
+				ixval = 1;
 			else if (strcmp(argv[i], "-t") == 0 || strcmp(argv[i], "/t") == 0) {
-				if (sscanf (argv[i+1], "%i", &nthreads) !=1 ) {
+				if (i + 1 >= argc || sscanf (argv[i+1], "%i", &nthreads) !=1 ) {
 					printf ("ERROR - t option not an integer\n");
 					exit(0);
 				}
+				if (nthreads < 1) {
+					printf ("ERROR - t option must be at least 1\n");
+					exit(0);
+				}
 				if (nthreads > omp_get_max_threads()){
 					nthreads = omp_get_max_threads();
 					printf("WARNING - maximum number of threads is %i, using %i\n", omp_get_max_threads(), nthreads);
@@ -524,12 +590,12 @@ char *argv[];
 			j = 0;
 			while (j < mtper) {
 				for (i = 0; i < nsta; i++)
-					if (sta[i].data[j][k] < missing)
+					if (DATA(i, j, k) < missing)
 						break;
 				if (i < nsta) {
 					fprintf(fpout, "%4d %4d", year[k], j+1);
 					for (i = 0; i < nsta; i++)
-						fprintf(fpout, "%8.2f", sta[i].data[j][k]);
+						fprintf(fpout, "%8.2f", DATA(i, j, k));
 					fprintf(fpout, "\n");
 				}
 				j++;
@@ -559,12 +625,12 @@ char *argv[];
 			j = 0;
 			while (j < mtper) {
 				for (i = 0; i < nsta; i++)
-					if (sta[i].data[j][k] < missing)
+					if (DATA(i, j, k) < missing)
 						break;
 				if (i < nsta) {
 					fprintf(fpout, "\n%4d", j+1);
 					for (i = 0; i < nsta; i++)
-						fprintf(fpout, "%8.2f", sta[i].data[j][k]);
+						fprintf(fpout, "%8.2f", DATA(i, j, k));
 				}
 				j++;
 			}
@@ -599,13 +665,17 @@ for (i = 0; i < ngrid; i++) {
 		b0 = matrix(nper, nyear);
 		b1 = matrix(nper, nyear);
 	}
-	dgrid = matrix(ngrid, nsta);
 	elevations = vector(nsta);
-	gprec = vector(ngrid);
 	map = matrix(mtper, nyear);
 	//	staflg = ivector(nsta);
-//	w = dvector(nstap1);
-	wall = matrix(ngrid, nsta);
+	w = dvector(nstap1);
+	if (ivar == 1 && iwt == 1 && iout >= 3) {
+		wvar = vector(ngrid);
+		for (i = 0; i < ngrid; i++)
+			wvar[i] = 0;
+	}
+	else
+		ivar = 0;
 	x = dvector(nsta);
 	y = dvector(nsta);
 	if (type == 3) {
@@ -616,6 +686,31 @@ for (i = 0; i < ngrid; i++) {
 		snolin = matrix(nper, nyear);
 	}
 
+	/* Make list of used grid cells */
+
+	iuse = ivector(ngrid);
+	ngriduse = 0;
+	for (i = 0; i < ngrid; i++)
+		if (grid[i].use == 1)
+			iuse[ngriduse++] = i;
+
+	/* Kriging weights of all stations, one row per grid cell.  The rows
+	   are in one block, those of the used grid cells first and in the
+	   order of iuse, so that the weights of consecutive used grid cells
+	   are one matrix (tstep_krige()) */
+
+	wall = (float **) malloc(ngrid * sizeof(float *));
+	if (wall == NULL) {
+		printf("\n\nAllocation failure of kriging weight matrix\n");
+		exit(0);
+	}
+	wblock = vector(ngrid * nsta);
+	for (k = 0; k < ngriduse; k++)
+		wall[iuse[k]] = wblock + (size_t) k * nsta;
+	for (i = 0; i < ngrid; i++)
+		if (grid[i].use != 1)
+			wall[i] = wblock + (size_t) k++ * nsta;
+
 	/* Initialize b0, b1, and map matrices to missing code */
 
 	if (istorm == 1) {
@@ -639,9 +734,9 @@ for (i = 0; i < ngrid; i++) {
 			for (j = 0; j < mtper; j++) {
 				izero = 0;
 				for (i = 0; i < nsta; i++) {
-					if (sta[i].data[j][k] < missing) {
+					if (DATA(i, j, k) < missing) {
 						izero = 1;
-						if (sta[i].data[j][k] > 0.001) {
+						if (DATA(i, j, k) > 0.001) {
 							izero = 0;
 							break;
 						}
@@ -660,8 +755,70 @@ printf("\nMAP for period %d year %d = %8.4f\n", j+1, year[k], map[j][k]);
 
 	/* Read or calculate kriging weights */
 
+	omp_set_dynamic(0);     // Explicitly disable dynamic teams
+	omp_set_num_threads(nthreads); // Use N threads for all consecutive parallel regions
+
 	if (iwt == 1) {
 
+		/* Distances are needed both for the weights for all stations and
+		   for recalculating weights on timesteps with missing stations */
+
+		/* Index stations for neighborhood searches, and set up station
+		   vectors for distances from grid cells */
+
+		staidx_build();
+		dist_grid_init();
+		kfcache_init();
+
+		/* Residuals of the mixed-precision solver by grid cell */
+
+		if (isolv == 4) {
+			kresid = vector(ngrid);
+			for (i = 0; i < ngrid; i++)
+				kresid[i] = 0;
+		}
+
+		/* Compute distances between stations and load distances into
+            ad matrix for later use in solving linear system for kriging weights */
+
+#pragma omp parallel for private(j, ewdist, nsdist) schedule(dynamic)
+		for (i = 0; i < nsta; i++) {
+			ad[i][i] = 0;
+			elevations[i] = sta[i].elev;
+			for (j = i+1; j < nsta; j++) {
+				if (icoord == 1)
+					ad[i][j] = ad[j][i] = dist_ll(sta[i].north, sta[i].east,
+							sta[j].north, sta[j].east,
+							&ewdist, &nsdist);
+				else
+					ad[i][j] = ad[j][i] = dist_en(sta[i].north, sta[i].east,
+							sta[j].north, sta[j].east);
+			}
+		}
+
+		/* (Distances between grid cells and prec/temp/swe stations are
+		   computed as they are needed, by dist_grid() and
+		   dist_grid_row()) */
+
+		if (iprintdistances == 1) {
+			/* print out distances among stations and grid cells */
+			fprintf(fpout, "\n\n\nMatrix of distances between stations (km):\n");
+			for (i = 0; i < nsta; i++) {
+				fprintf(fpout, "\n");
+				for (j = 0; j < nsta; j++)
+					fprintf(fpout, "%9.2f", ad[i][j]);
+			}
+			fprintf(fpout, "\n\n\n%s\n",
+					"Distances between grid cells and prec/temp/swe stations (km):");
+			for (i = 0; i < ngrid; i++) {
+				if (grid[i].use == 1) {
+					fprintf(fpout, "\n%d", i+1);
+					for (j = 0; j < nsta; j++)
+						fprintf(fpout, "%9.2f", dist_grid(i, j));
+				}
+			}
+		}
+
 		if (ikwfile == 1) {
 
 			/* If specified by command line switch, read kriging weights from
@@ -692,87 +849,26 @@ printf("\nMAP for period %d year %d = %8.4f\n", j+1, year[k], map[j][k]);
 				for (j = 0; j < nsta; j++)
 					fscanf(fpkw, "%f", &wall[i-1][j]);
 			}
+			if (ivar == 1)
+				for (i = 0; i < ngrid; i++)
+					if (grid[i].use == 1)
+						wvar[i] = (float) krige_var(i, nsta, NULL, wall[i]);
 		}
 
-		else {
-
-			/* Calculate kriging weights */
+		else if (ixval == 0) {
 
-			printf("\nNow calculating kriging weights ...\n");
+			/* Calculate kriging weights (not needed for cross-validation)
+			   using all stations, or read them from weight-cache-dir if
+			   kept there by an earlier run with the same inputs */
 
-			/* Compute distances between stations and load distances into
-            ad matrix for later use in solving linear system for kriging weights */
-
-			for (i = 0; i < nsta; i++) {
-				ad[i][i] = 0;
-				elevations[i] = sta[i].elev;
-				for (j = i+1; j < nsta; j++) {
-					if (icoord == 1)
-						ad[i][j] = ad[j][i] = dist_ll(sta[i].north, sta[i].east,
-								sta[j].north, sta[j].east,
-								&ewdist, &nsdist);
-					else
-						ad[i][j] = ad[j][i] = dist_en(sta[i].north, sta[i].east,
-								sta[j].north, sta[j].east);
-				}
-			}
-
-			/* Compute distances between grid cells and prec/temp/swe stations */
-
-			for (i = 0; i < ngrid; i++) {
-				if (grid[i].use == 1) {
-					for (j = 0; j < nsta; j++) {
-						if (icoord == 1)
-							dgrid[i][j] = dist_ll(grid[i].north, grid[i].east,
-									sta[j].north, sta[j].east, &ewdist,
-									&nsdist);
-						else
-							dgrid[i][j] = dist_en(grid[i].north, grid[i].east,
-									sta[j].north, sta[j].east);
-					}
-				}
-			}
-
-			if (iprintdistances == 1) {
-				/* print out distances among stations and grid cells */
-				fprintf(fpout, "\n\n\nMatrix of distances between stations (km):\n");
-				for (i = 0; i < nsta; i++) {
-					fprintf(fpout, "\n");
-					for (j = 0; j < nsta; j++)
-						fprintf(fpout, "%9.2f", ad[i][j]);
-				}
-				fprintf(fpout, "\n\n\n%s\n",
-						"Distances between grid cells and prec/temp/swe stations (km):");
-				for (i = 0; i < ngrid; i++) {
-					if (grid[i].use == 1) {
-						fprintf(fpout, "\n%d", i+1);
-						for (j = 0; j < nsta; j++)
-							fprintf(fpout, "%9.2f", dgrid[i][j]);
-					}
-				}
-			}
-
-			/* Calculate kriging weights using all stations */
-			omp_set_dynamic(0);     // Explicitly disable dynamic teams
-			omp_set_num_threads(nthreads); // Use N threads for all consecutive parallel regions
 			if (N < 0)
 				N = nsta;
 
-			double w[nsta+1];
-			#pragma omp parallel shared(nsta, ad, dgrid, elevations, grid, N) private(i, j, w)
-			{
-				#pragma omp for
-				for (i = 0; i < ngrid; i++) {
-
-					if (grid[i].use == 1) {
-
-						krige(i, nsta, ad, dgrid, elevations, w);
-
-						for (j = 0; j < nsta; j++){
-							wall[i][j] = (float) w[j];
-						}
-					}
-				}
+			if (kwdir[0] == '\0' || kwstore_load() == 0) {
+				printf("\nNow calculating kriging weights ...\n");
+				kweng(NULL, nsta, NULL, wall, wvar);
+				if (kwdir[0] != '\0')
+					kwstore_save();
 			}
 		}
 	}
@@ -788,7 +884,7 @@ printf("\nMAP for period %d year %d = %8.4f\n", j+1, year[k], map[j][k]);
 			}
 	}
 
-	if (iprintweights == 1) {
+	if (iprintweights == 1 && ixval == 0) {
 		/* Print out weights */
 		fprintf(fpout, "\n\n\nGrid\nPt.:   Kriging weights:\n");
 		for (i = 0; i < ngrid; i++) {
@@ -866,8 +962,8 @@ printf("\nMAP for period %d year %d = %8.4f\n", j+1, year[k], map[j][k]);
 			for (j = 0; j < mtper; j++) {
 				fprintf(fpout, "\n%4d", j+1);
 				for (k = 0; k < nyear; k++) {
-					if (sta[i].data[j][k] < accum)
-						fprintf(fpout, "%10.6f", sta[i].data[j][k]);
+					if (DATA(i, j, k) < accum)
+						fprintf(fpout, "%10.6f", DATA(i, j, k));
 					else
 						fprintf(fpout, "          ");
 				}
@@ -876,6 +972,15 @@ printf("\nMAP for period %d year %d = %8.4f\n", j+1, year[k], map[j][k]);
 		fprintf(fpout, "\n\n");
 	}
 
+	/* Cross-validate detrended residuals and exit, if requested
+      (-x switch) */
+
+	if (ixval == 1) {
+		printf("\nNow cross-validating detrended residuals ...\n");
+		xvalid();
+		exit(0);
+	}
+
 
 	/* For each day, compute kriging weights (if there are stations with
       missing data), estimate grid cell values, and compute areal averages */
@@ -925,6 +1030,16 @@ printf("\nMAP for period %d year %d = %8.4f\n", j+1, year[k], map[j][k]);
 	}
 	fprintf(fpout, "\n");
 
+	if (iwt == 1) {
+		kweng_report();
+		kwcache_report();
+		kfcache_report();
+	}
+	if (iwt == 1 && isolv == 3)
+		ldlcheck_report();
+	if (iwt == 1 && isolv == 4)
+		ldlresid_report();
+
 	return 0;
 }
 
@@ -1,3 +1,21 @@
+#define DATA(i, j, k) stdata[((size_t) (k) * mtper + (j)) * nsta + (i)]
+                                 /* data of station i for day (time step) j
+                                    of year k */
+#define KBMAX 32                 /* maximum number of stations for a grid
+                                    cell solved by kbatch() */
+#define KGBLK 4096               /* number of used grid cells in a block
+                                    of the parallel grid loop */
+#define KGPAR 262144             /* number of used grid cells from which
+                                    the grid loop of each timestep is run
+                                    in parallel instead of several
+                                    timesteps at once */
+#define KLANE 8                  /* number of grid cells solved together
+                                    by kbatch() */
+#define KTBATCH 4                /* number of timesteps per thread kriged
+                                    in parallel between fetches from the
+                                    weight cache */
+#define KTRUN 8                  /* maximum number of timesteps with the
+                                    same kriging weights kriged together */
 #define MGRID 16000000           /* maximum number of grid cells */
 #define MSTA 100                 /* maximum number of stations */
 #define MSTORM 300               /* maximum number of storms */
@@ -5,3 +23,6 @@
                                     in a year (e.g., 8784=hourly data,
                                     366 = daily data) */
 #define MZONE 1000               /* maximum number of zones */
+#define NKWORD ((MSTA + 63) / 64) /* number of words in a station bitmask */
+#define NREFINE 1                /* steps of iterative refinement in the
+                                    mixed-precision kriging solver */
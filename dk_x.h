@@ -16,23 +16,38 @@ extern struct {
 } arc;
 extern void arcout();            /* function to write out daily grids in
                                     ARC/INFO format */
+extern float *avector();         /* aligned float vector space allocation
+                                    function */
 extern float **b0, **b1;         /* matrices of regression intercepts
                                     and slopes */
 extern float **b02, **b12;       /* matrices of intercepts and slopes for line
                                     between highest zero and lowest nonzero
                                     swe values */
 extern double b0dum, b1dum;      /* temporary intercept and slope variables */
+extern int chlfact();            /* Cholesky factorization of kriging
+                                    matrix (USE_LAPACK) */
+extern void chlsolv();           /* kriging solver with Cholesky factor
+                                    (USE_LAPACK) */
 extern char dataname[21];        /* name of data type in csv input file
                                     (precip, tmax, or tmin) */
 /* extern int dayfrac;              day fraction of data
                                     (beginning of time period) */
-extern float **dgrid;            /* matrix of distances between grid cells
-                                    and prec/temp stations */
 extern float dist_en();          /* function to calculate distances between
                                     stations based on eastings and northings */
 extern float dist_ll();          /* function to calculate distances between
                                     stations based on latitude and longitude */
+extern float dist_grid();        /* function to calculate distance between
+                                    a grid cell and a station */
+extern void dist_grid_init();    /* function to set up station vectors for
+                                    distances from grid cells */
+extern void dist_grid_row();     /* function to calculate distances between
+                                    a grid cell and many stations */
+extern void dist_ll_len();       /* function to get lengths of a degree for
+                                    dist_ll() */
+extern void dist_ll_scale();     /* function to get km per degree bounds
+                                    for dist_ll() */
 extern double **dmatrix();       /* double matrix space allocation function */
+extern void dmatmul();           /* matrix product (matmul.c) */
 extern int dpp;                  /* days (time steps) per period */
 extern int dppl;                 /* days (time steps) in last period */
 extern int dstop;                /* stopping day (time step) for storm index */
@@ -40,6 +55,7 @@ extern float dum;                /* intermediate calculation variable */
 extern double *dvector();        /* double vector space allocation function */
 extern int dy_end;               /* ending day of OMS-csv input file */
 extern int dy_start;             /* starting day of OMS-csv input file */
+extern float *elevations;        /* vector of elevation for each station */
 extern double exp();             /* exponential function */
 extern int *firstday;            /* vector of first day (period) of data for each year */
 extern FILE *fopen();            /* file open function */
@@ -47,8 +63,6 @@ extern FILE *fpin1, *fpin2, *fpin3, *fpin4;
                                  /* pointers to input files */
 extern FILE *fpout, *fpzone;     /* pointers to output files */
 extern int getln();              /* function to read line from file */
-extern float *gprec;             /* vector of precip at grid cells for
-                                    one day */
 extern struct {
    double north;                 /* northernmost extent of GRASS raster */
    double south;                 /* southernmost extent of GRASS raster */
@@ -81,11 +95,11 @@ extern int igridpr;              /* flag for precision of values in GRASS or
                                     decimal place; 2=integer, 3=integer*10 */
 extern int imask;                /* flag indicating if watershed mask is to be
                                     used for calculating spatial averages */
-extern int imiss;                /* flag to indicate if one or more stations
-                                    have missing data */
 extern int iout;                 /* output format (1 = tabular,
                                     2 = GRASS+tabular, 3 = ARC+tabular,
                                     4 = IPW+tabular) */
+extern int *iuse;                /* vector of indexes of used grid cells */
+extern int ivar;                 /* 1 = write kriging variance grids */
 extern void ipwout();            /* function to write out daily grids in
                                     IPW format */
 extern int isleap();             /* determine if given year is a leap year
@@ -97,16 +111,110 @@ extern int irmeth;               /* regression method flag:
                                     1 = least squares regression
                                     2 = least absolute deviations */
 extern int *ivector();           /* int vector space allocation function */
+extern int isolv;                /* kriging system solver (1 = LU
+                                    decomposition, 2 = symmetric, 3 =
+                                    symmetric checked against LU, 4 =
+                                    symmetric in mixed precision) */
+extern int iwarm;                /* 1 = elimination of stations with negative
+                                    weights starts from the stations left at
+                                    the previous grid cell */
+extern int iweng;                /* kriging weight engine (1 = solve each
+                                    grid cell separately, 2 = factor station
+                                    matrix once for all grid cells,
+                                    3 = closed form from inverse of station
+                                    distance matrix) */
 extern int iwt;                  /* station weighting flag (1 = distance
                                     weighting; 2 = equal weighting) */
 extern int izero;                /* flag indicating a day where all stations
                                     have zero precipitation (izero = 1) */
 extern int izone;                /* flag indicating if zones (such as hydrologic 
                                     response units) are to be defined */
+extern int kbatch();             /* kriging function for several grid
+                                    cells together */
+extern float kfcmb;              /* memory limit of kriging factorization
+                                    cache (MB) */
+extern int kfcache_get();        /* function to get cached factors of
+                                    kriging matrix */
+extern void kfcache_put();       /* function to add factors of kriging
+                                    matrix to cache */
+extern float *kresid;            /* largest relative residual of kriging
+                                    equations for each grid cell
+                                    (kriging-solver = 4) */
 extern double *krige();             /* kriging function */
+extern int krige_stations();     /* function to find stations for kriging
+                                    a grid cell */
+extern double krige_var();       /* function to compute kriging variance */
+extern void kweng();             /* kriging weight engine */
+extern void kweng_report();      /* function to write out time spent by
+                                    each thread on kriging weights */
+extern struct kwork {
+   int nmax;                     /* number of stations space is sized for */
+   int lda;                      /* row length of a */
+   double *a;                    /* kriging system ((nmax+1) x lda) */
+   double *z;                    /* inverse columns for removed stations
+                                    (same size as a) */
+   double *c;                    /* inverse at removed stations (same size
+                                    as a) */
+   double *wcalc;                /* calculation vector for weights */
+   double *vv;                   /* row scaling for ludcmp() */
+   double *x0;                   /* solution of factored system */
+   double *y;                    /* correction for removed stations */
+   double *cvv;                  /* row scaling for ludcmp() of c */
+   double *p;                    /* packed factors for ldlfact() (same size
+                                    as a) */
+   float *pf;                    /* packed factors for ldlfactf() (same
+                                    size as a) */
+   double *rw;                   /* scratch space for ldlfactf() and
+                                    ldlsolvm() (3*(nmax+1)) */
+   double *u;                    /* inv(M)*1 from ldlfact() */
+   int *indx;                    /* row permutation from pivoting */
+   int *idx;                     /* indexes of stations in use */
+   int *cindx;                   /* row permutation for c */
+   int *rem;                     /* positions of removed stations */
+   int *act;                     /* flags for factored stations in use */
+   int *cand;                    /* candidate stations (warm start) */
+   int *fin;                     /* stations left after elimination at
+                                    the previous grid cell */
+   int nfin;                     /* number of stations in fin (0 = none) */
+   float *dist;                  /* distances to stations */
+   float *dg;                    /* distances from grid cell to stations,
+                                    by station index */
+   double *bp;                   /* interleaved packed matrices for
+                                    kbatch() */
+   double *bg;                   /* interleaved packed distances for
+                                    kbatch() */
+   double *bu;                   /* interleaved inv(M)*1 for kbatch() */
+   double *bv;                   /* interleaved solutions for kbatch() */
+   int *bidx;                    /* stations of each cell for kbatch() */
+} *kwork_get();                  /* function to get scratch space of calling
+                                    thread for krige() */
+extern float *kwcache_get();     /* function to get kriging weights for a
+                                    station availability pattern */
+extern int kwcache_held();       /* function to tell if kriging weights
+                                    from kwcache_get() are held in cache */
+extern void kwcache_release();   /* function to give back kriging weights
+                                    from kwcache_get() */
+extern void kwcache_report();    /* function to write out weight cache
+                                    statistics */
+extern float kwcmb;              /* memory limit of kriging weight cache (MB) */
+extern char kwdir[];             /* directory of kriging weight files kept
+                                    between runs (blank = none) */
 extern int *lastday;             /* vector of last day (period) of data for each year */
 extern int len;                  /* string length */
 extern char line[501];           /* input line buffer */
+extern void ldlbksbm();          /* backsubstitution for symmetric solver */
+extern void ldlcheck();          /* function to check symmetric solver
+                                    against LU decomposition */
+extern void ldlcheck_report();   /* function to write out solver check */
+extern int ldlfact();            /* symmetric factorization of kriging
+                                    matrix */
+extern int ldlfactf();           /* single-precision symmetric
+                                    factorization of kriging matrix */
+extern void ldlresid_report();   /* function to write out residuals of
+                                    mixed-precision solver */
+extern void ldlsolv();           /* symmetric solver for kriging system */
+extern void ldlsolvm();          /* mixed-precision solver for kriging
+                                    system */
 extern int luret;                /* return value from lusolv() */
 extern int lusolv();             /* linear equation solver - LU decomposition */
 extern double mae;               /* mean absolute error */
@@ -124,11 +232,14 @@ extern float nbits;				 /* number of bits for IPW image */
 extern int netcdfout();			 /* NETCDF output function */
 extern int ngrid;                /* number of grid cells */
 extern int ngriduse;             /* number of grid cells used (non-missing) */
+extern int N;                    /* number of closest stations to use in
+                                    kriging (< 0 = all) */
 extern int nmask;                /* number of grid cells within watershed mask */
 extern int nper;                 /* number of periods */
 extern int nperm1;               /* nper minus 1 */
 extern int nsta;                 /* number of stations */
 extern int nstop;                /* stopping value for loop index n */
+extern int istorm;               /* flag for storm option */
 extern int nstorm;               /* number of storms */
 extern int nyear;                /* number of years of data */
 extern int nzone;                /* number of zones */
@@ -143,28 +254,75 @@ extern float replace;            /* code to replace an accumulated precip
 extern int ret;                  /* function return code */
 extern int roundVal;			 /* number of decimal place to round to 10^roundVal */
 extern double se;                /* standard error */
+extern void smatmul();           /* single precision matrix product
+                                    (matmul.c) */
 extern float **snolin;           /* snowline */
+extern float srad;               /* search radius (km) for stations used in
+                                    kriging each grid cell (< 0 = none) */
+extern int sradmax;              /* maximum number of stations within search
+                                    radius (< 0 = no limit) */
+extern int sradmin;              /* minimum number of stations for search
+                                    radius */
+extern void selectn();           /* partial selection of smallest values */
 extern int sreg();               /* simple linear regression function */
 extern int sreg_const();               /* simple linear regression function */
+extern void staidx_build();      /* function to build spatial index of
+                                    stations */
+extern int staidx_nearest();     /* function to find nearest stations */
+extern int staidx_radius();      /* function to find stations within a
+                                    radius */
 extern struct {
    char id[26];                  /* station identifier */
    float elev;                   /* elevation (thousands) */
    float east;                   /* easting (or longitude) of station */
    float north;                  /* northing (or latitude) of station */
-   float **data;                 /* data matrix */
 } sta[];
 extern int *staflg;              /* station use flags */
+extern float *stdata;            /* station data, the stations of each time
+                                    step together (see DATA() in dk_m.h) */
 extern struct {
    int dstart;                   /* index of starting day of storm */
    int ystart;                   /* index of starting year of storm */
    int slen;                     /* storm length (days) */
 } storm[];
 extern double t;                 /* t-statistic */
+extern struct tstep {
+   float *g;                     /* estimates at used grid cells for the
+                                    timesteps of a run (KTRUN x ngriduse) */
+   float *v;                     /* kriging variances at used grid cells
+                                    for the timesteps of a run (KTRUN x
+                                    ngriduse, kriging-variance only) */
+   int nday;                     /* number of grids gd and vd can hold */
+   float *gd;                    /* copies of g for the days of a period
+                                    (nday x ngriduse) */
+   float *vd;                    /* copies of v for the days of a period
+                                    (nday x ngriduse, kriging-variance
+                                    only) */
+   float *r;                     /* residuals of stations with data for
+                                    the timesteps of a run (nsta x KTRUN) */
+   double *w;                    /* equal weights of stations with data */
+   int *ista;                    /* indexes of stations with data */
+   float *bs;                    /* sums of blocks of used grid cells for
+                                    the timesteps of a run (blocks x
+                                    KTRUN) */
+   float *zm;                    /* zonal means of the days of a run found
+                                    without their grids ((nday + KTRUN) x
+                                    nzone, zones only) */
+} *tstep_get();                  /* function to get grid buffers of calling
+                                    thread for a run of timesteps */
+extern float *tstep_full();      /* function to scatter the used grid cells
+                                    of a grid into a raster grid */
+extern void tstep_krige();       /* function to multiply kriging weights by
+                                    residuals for a run of timesteps */
+extern void tstep_write();       /* function to write out the grids of a
+                                    timestep */
 extern int type;                 /* data type (1 = prec, 2 = temp, 3 = swe, 
                                     4 = other) */
 extern float *vector();          /* float vector space allocation function */
 extern double *w;                /* kriging weights */
 extern float **wall;             /* kriging weight matrix for all stations */
+extern float *wvar;              /* kriging variance at grid cells for
+                                    weights of all stations */
 extern double *x, *y;            /* regression data vectors */
 extern float *xd, *yd;			 /* data grid vectors */
 extern int *year;                /* years of data */
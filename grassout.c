@@ -20,6 +20,10 @@
  *       Changed file naming convention to reflect generic time periods
  *       instead of days, and removed day fraction.
  *       Example:  prc_2004_6358.grs
+ *
+ *    Modification, October 2026:
+ *       The grid to write is passed in, since timesteps are kriged in
+ *       parallel into grids of their own
  */
 
 #include <stdio.h>
@@ -27,9 +31,10 @@
 
 #include "dk_x.h"
 
-void grassout(iy, ip)
+void grassout(iy, ip, g)
 int iy;                          /* year */
 int ip;                          /* period (sequential number beginning Oct 1) */
+float *g;                        /* grid values */
 {
    char buf[6];                  /* buffer for file name building */
    FILE *fpgrs;                  /* output file pointer */
@@ -74,11 +79,11 @@ int ip;                          /* period (sequential number beginning Oct 1) *
    for (i = 0; i < grass.rows; i++) {
       for (j = 0; j < grass.cols; j++) {
          if (igridpr == 1)
-            fprintf(fpgrs, "%.1f ", gprec[++k]);
+            fprintf(fpgrs, "%.1f ", g[++k]);
          else if (igridpr == 2)
-            fprintf(fpgrs, "%.0f ", gprec[++k]);
+            fprintf(fpgrs, "%.0f ", g[++k]);
          else if (igridpr == 3)
-            fprintf(fpgrs, "%.0f ", (gprec[++k]*10));
+            fprintf(fpgrs, "%.0f ", (g[++k]*10));
       }
       fprintf(fpgrs, "\n");
    }
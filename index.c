@@ -58,3 +58,82 @@ int n;                           /* number of elements to sort */
    }
 }
 
+
+/*
+ *    selectn.c
+ *
+ *    Rearranges the index array indx[0..n-1] so that arr[indx[0]], ... ,
+ *    arr[indx[k-1]] are the k smallest of the values referenced by indx
+ *    (in no particular order).  The average work is proportional to n,
+ *    rather than n log n for a full sort.  The values in arr are not
+ *    changed.
+ *
+ *    This program is adapted from the program "select" in:
+ *    Press, William H., Saul A. Teukolsky, William T. Vetterling, and
+ *    Brian P. Flannery, Numerical Recipes in C:  The Art of Scientific
+ *    Computing, 2nd ed., Cambridge University Press, 1992, p. 342.
+ */
+
+#define SWAPI(a, b) { itemp = (a); (a) = (b); (b) = itemp; }
+
+void selectn(arr, indx, n, k)
+float *arr;                      /* input vector */
+int *indx;                       /* index vector */
+int n;                           /* number of elements in indx */
+int k;                           /* number of smallest elements wanted */
+{
+   int i, ia, ir, itemp, j, kk, l, mid;
+   float a;
+
+   if (k <= 0 || k >= n)
+      return;
+   kk = k - 1;
+   l = 0;
+   ir = n - 1;
+   while (1) {
+
+      /* Active partition contains 1 or 2 elements */
+
+      if (ir <= l + 1) {
+         if (ir == l + 1 && arr[indx[ir]] < arr[indx[l]])
+            SWAPI(indx[l], indx[ir]);
+         return;
+      }
+
+      /* Choose median of left, center, and right elements as
+         partitioning element a, and rearrange so that
+         arr[indx[l]] <= arr[indx[l+1]] <= arr[indx[ir]] */
+
+      mid = (l + ir) / 2;
+      SWAPI(indx[mid], indx[l+1]);
+      if (arr[indx[l]] > arr[indx[ir]])
+         SWAPI(indx[l], indx[ir]);
+      if (arr[indx[l+1]] > arr[indx[ir]])
+         SWAPI(indx[l+1], indx[ir]);
+      if (arr[indx[l]] > arr[indx[l+1]])
+         SWAPI(indx[l], indx[l+1]);
+
+      /* Partition around a */
+
+      i = l + 1;
+      j = ir;
+      ia = indx[l+1];
+      a = arr[ia];
+      while (1) {
+         do i++; while (arr[indx[i]] < a);
+         do j--; while (arr[indx[j]] > a);
+         if (j < i)
+            break;
+         SWAPI(indx[i], indx[j]);
+      }
+      indx[l+1] = indx[j];
+      indx[j] = ia;
+
+      /* Keep active the partition that contains the kth element */
+
+      if (j >= kk)
+         ir = j - 1;
+      if (j <= kk)
+         l = i;
+   }
+}
@@ -8,6 +8,7 @@
 
 #include <stdio.h>
 
+#include "dk_m.h"
 #include "dk_x.h"
 
 float interp(i, jstart, kstart)
@@ -22,7 +23,7 @@ int kstart;                      /* year index of start of accum. period */
    j = jstart;
    k = kstart;
    while (1) {
-      if (sta[i].data[j][k] > accum && sta[i].data[j][k] < missing) {
+      if (DATA(i, j, k) > accum && DATA(i, j, k) < missing) {
          n++;
          j++;
          if (j > dstop) {
@@ -33,8 +34,8 @@ int kstart;                      /* year index of start of accum. period */
       else
          break;
    }
-   dum = sta[i].data[j][k] / n;
-   sta[i].data[j][k] = (float) (replace + 0.1);
+   dum = DATA(i, j, k) / n;
+   DATA(i, j, k) = (float) (replace + 0.1);
    return(dum);
 }
 
@@ -44,6 +44,10 @@
  *       Changed file naming convention to reflect generic time periods
  *       instead of days, and removed day fraction.
  *       Example:  prc_2004_6358.ipw
+ *
+ *    Modification, October 2026:
+ *       The grid to write is passed in, so that kriging variance grids
+ *       can be written as well.  Example:  prc_var_2004_6358.ipw
  */
 
 #include <math.h>
@@ -56,9 +60,11 @@ unsigned int int_to_int(unsigned int k) {
 	return (k == 0 || k == 1 ? k : ((k % 2) + 10 * int_to_int(k / 2)));
 }
 
-void ipwout(iy, ip)
+void ipwout(iy, ip, g, kv)
 int iy;                          /* year */
 int ip;                          /* period (sequential number beginning Oct 1) */
+float *g;                        /* grid values */
+int kv;                          /* 1 = kriging variance grid */
 {
 	char buf[6];                  /* buffer for file name building */
 	float delta;                  /* number of image units per data unit
@@ -72,7 +78,7 @@ int ip;                          /* period (sequential number beginning Oct 1) *
 	float max;                    /* maximum value of variable */
 	float min;                    /* minimum value of variable */
 	int int_max;				  /* maximum value of the map */
-	char outfile[21];             /* output file name */
+	char outfile[25];             /* output file name */
 	//	float nbits;				  /* number of bits */
 	int nbytes;
 
@@ -99,10 +105,10 @@ int ip;                          /* period (sequential number beginning Oct 1) *
 	max = -100000000;
 	for (i = 1; i < ngrid; i++) {
 		if (grid[i].use == 1) {
-			if (gprec[i] < min)
-				min = gprec[i];
-			if (gprec[i] > max)
-				max = gprec[i];
+			if (g[i] < min)
+				min = g[i];
+			if (g[i] > max)
+				max = g[i];
 		}
 	}
 	delta = (float) (int_max / (max - min));
@@ -117,6 +123,8 @@ int ip;                          /* period (sequential number beginning Oct 1) *
 		strcpy(outfile, "swe_");
 	else
 		strcpy(outfile, "dat_");
+	if (kv == 1)
+		strcat(outfile, "var_");
 	sprintf(buf, "%04d_", iy);
 	strcat(outfile, buf);
 	sprintf(buf, "%04d", (ip+1));
@@ -143,6 +151,8 @@ int ip;                          /* period (sequential number beginning Oct 1) *
 				"!<header> basic_image_i -1", "byteorder = 3210",
 				"nlines = ", arc.rows, "nsamps = ", arc.cols,
 				"nbands = 1", "annot = ");
+	if (kv == 1)
+		fprintf(fpipw, "kriging variance of ");
 	if (type == 1)
 		fprintf(fpipw, "precipitation");
 	else if (type == 2)
@@ -178,7 +188,9 @@ int ip;                          /* period (sequential number beginning Oct 1) *
 	/* Linear quantization header */
 
 	fprintf(fpipw, "!<header> lq 0\nunits = ");
-	if (type == 1 || type == 3)
+	if (kv == 1)
+		fprintf(fpipw, "distance\nmap = 0 %6.2f\nmap = %i %6.2f\n", min, int_max, max);
+	else if (type == 1 || type == 3)
 		fprintf(fpipw, "mm\nmap = 0 %7.2f\nmap = %i %7.2f\n", min, int_max, max);
 	else if (type == 2)
 		fprintf(fpipw, "C\nmap = 0 %6.2f\nmap = %i %6.2f\n", min, int_max, max);
@@ -191,12 +203,12 @@ int ip;                          /* period (sequential number beginning Oct 1) *
 
 	if (nbits == 8) {
 		for (i = 0; i < ngrid; i++) {
-			ival = (int) ((gprec[i] - min) * delta + 0.5);
+			ival = (int) ((g[i] - min) * delta + 0.5);
 			fprintf(fpipw, "%c", (char) (ival & 0xFF));
 		}
 	} else if (nbits == 16) {
 		for (i = 0; i < ngrid; i++) {
-			ival = (int) ((gprec[i] - min) * delta + 0.5);
+			ival = (int) ((g[i] - min) * delta + 0.5);
 			fprintf(fpipw, "%u", (short) (ival & 0xffff));
 		}
 		printf("%i\n",i);
@@ -0,0 +1,369 @@
+/*
+ *    kbatch.c
+ *
+ *    Solve the kriging systems of several grid cells together
+ *
+ *    When each grid cell is kriged with its own (small) set of stations,
+ *    a single system is too small to keep the vector units of the
+ *    processor busy.  Here the systems of KLANE grid cells are laid out
+ *    side by side, element (i,j) of all KLANE packed matrices next to
+ *    each other, and factored and solved in lockstep by the method of
+ *    ldlsolv.c, so that every inner loop runs across the KLANE cells.
+ *    Systems with fewer stations than the largest in the batch are
+ *    padded with identity rows that take no part in the Lagrange
+ *    constraint.
+ *
+ *    Stations with negative weights are eliminated one per cell per
+ *    round, in the order of krige().  Taking station k out of
+ *    M = L*D*L' leaves rows 0..k-1 of the factors alone and changes the
+ *    rows below k by the rank-one update
+ *
+ *       L2'*D2'*L2'' = L2*D2*L2' + D(k) * l*l',   l = L(k+1..,k)
+ *
+ *    after which row k becomes a padding row.  All lanes run the update
+ *    together; for a lane with nothing to eliminate, l = 0 and the update
+ *    changes nothing.  A cell is masked once its weights are final.
+ *    When half of the lanes are masked, they take the next grid cells
+ *    of the list and the batch is always factored again, so that the
+ *    weights of a cell depend only on the cells of the list and not on
+ *    what other threads have put in the factorization cache (kfcache.c)
+ *    meanwhile; the factors of the new cells are added to the cache for
+ *    krige().  A cell whose factorization fails, or that has more than
+ *    KBMAX stations, is left for krige().
+ */
+
+#include <stdio.h>
+
+#include "dk_m.h"
+#include "dk_x.h"
+
+#define PL(i, j) (((size_t) (i) * ((i) + 1) / 2 + (j)) * KLANE)
+
+/*
+ *    Compute the weights for grid cells cells[0..nc-1].  Weights for
+ *    cell p are returned in w[p*nsta..p*nsta+nsta-1] and done[p] is set
+ *    to 1; done[p] is 0 for a cell that must go through krige().
+ *    Returns the number of cells done.
+ */
+
+int kbatch(cells, nc, nsta, avail, w, done)
+int *cells;                      /* grid indexes of cells */
+int nc;                          /* number of cells */
+int nsta;                        /* number of stations */
+int *avail;                      /* station availability flags (NULL = all) */
+double *w;                       /* kriging weights */
+int *done;                       /* 1 = cell done, 0 = not */
+{
+	double alpha[KLANE];          /* scale of rank-one update */
+	double *ap;                   /* packed matrices, interleaved */
+	double beta[KLANE];           /* multipliers for rank-one update */
+	double *bg;                   /* packed distances among stations,
+	                                 interleaved */
+	double *bu, *bv;              /* inv(M)*1 and inv(M)*d, interleaved */
+	double c[KLANE];              /* shifts */
+	int cell[KLANE];              /* cell in each lane (index into cells,
+	                                 -1 = lane free) */
+	double dj[KLANE];             /* updated element of D */
+	float elevsave;               /* stored value of station elevation */
+	double *f;                    /* packed factors of one cell, for the
+	                                 cache */
+	int fresh[KLANE];             /* 1 = new cell in lane */
+	double *gij;                  /* element (i,j) of bg */
+	int i, j, k, p, q;            /* loop indexes */
+	int *idx;                     /* stations of each lane */
+	int kmin;                     /* first row changed by elimination */
+	struct kwork *kw;             /* scratch space of this thread */
+	double lij;                   /* element of L */
+	int msave[KLANE];             /* station to eliminate in each lane
+	                                 (-1 = none) */
+	int n[KLANE];                 /* number of stations in each lane */
+	int ndone;                    /* number of cells done */
+	int nnew;                     /* number of new cells */
+	int next;                     /* next cell to start */
+	int nfree;                    /* number of free lanes */
+	int nmax;                     /* largest number of stations */
+	int on[KBMAX * KLANE];        /* flags for stations still in use,
+	                                 interleaved */
+	double pad;                   /* element of padding row */
+	double *ri, *rj;              /* rows of packed matrices */
+	double s[KLANE];              /* 1'*inv(M)*1 */
+	double sum[KLANE];            /* summing variables */
+	double t[KLANE];              /* temporary values */
+	double tol[KLANE];            /* smallest acceptable pivots */
+	double z[KBMAX * KLANE];      /* vector of rank-one update, interleaved */
+
+	kw = kwork_get(nsta);
+	ap = kw->bp;
+	f = kw->p;
+	bg = kw->bg;
+	bu = kw->bu;
+	bv = kw->bv;
+	idx = kw->bidx;
+
+	for (q = 0; q < KLANE; q++) {
+		cell[q] = -1;
+		msave[q] = -1;
+		n[q] = 0;
+		c[q] = 1;
+		for (i = 0; i < KBMAX; i++)
+			on[i * KLANE + q] = 0;
+	}
+	ndone = 0;
+	next = 0;
+	nfree = KLANE;
+	while (1) {
+		nmax = 0;
+		for (q = 0; q < KLANE; q++)
+			if (cell[q] >= 0 && n[q] > nmax)
+				nmax = n[q];
+
+		/* Once half of the lanes are free, start the next cells in them
+		   (cells with too many stations are left for krige()), with the
+		   distances among their stations and their shifts */
+
+		nnew = 0;
+		if (nfree >= KLANE / 2 && next < nc) {
+			for (q = 0; q < KLANE; q++) {
+				fresh[q] = 0;
+				while (cell[q] < 0 && next < nc) {
+					p = next++;
+					done[p] = 0;
+					k = krige_stations(cells[p], nsta, avail, idx + q * nsta,
+							kw->dist);
+					if (k > KBMAX)
+						continue;
+					cell[q] = p;
+					n[q] = k;
+					msave[q] = -1;
+					nfree--;
+					c[q] = 0;
+					for (i = 0; i < k; i++) {
+						on[i * KLANE + q] = 1;
+						for (j = 0; j <= i; j++) {
+							gij = bg + PL(i, j) + q;
+							*gij = ad[idx[q * nsta + i]][idx[q * nsta + j]];
+							if (*gij > c[q])
+								c[q] = *gij;
+						}
+					}
+					if (c[q] <= 0)
+						c[q] = 1;
+					if (n[q] > nmax)
+						nmax = n[q];
+					fresh[q] = 1;
+					nnew++;
+				}
+			}
+			if (nfree == KLANE)
+				break;
+		}
+		else if (nfree == KLANE)
+			break;
+
+		/* With new cells, factor the batch again (this also takes out
+		   the stations found in the last round), and put the factors of
+		   the new cells in the cache */
+
+		if (nnew > 0) {
+			for (q = 0; q < KLANE; q++) {
+				tol[q] = 1.0e-12 * c[q];
+				msave[q] = -1;
+			}
+
+			for (i = 0; i < nmax; i++)
+				for (j = 0; j <= i; j++) {
+					gij = bg + PL(i, j);
+					ri = ap + PL(i, j);
+					pad = (i == j) ? 1 : 0;
+#pragma omp simd
+					for (q = 0; q < KLANE; q++)
+						ri[q] = (on[i * KLANE + q] & on[j * KLANE + q]) ?
+							c[q] - gij[q] : pad;
+				}
+
+			/* Factor M = L*D*L' in lockstep */
+
+			for (i = 0; i < nmax; i++) {
+				ri = ap + PL(i, 0);
+				for (j = 0; j < i; j++) {
+					rj = ap + PL(j, 0);
+					for (k = 0; k < j; k++) {
+#pragma omp simd
+						for (q = 0; q < KLANE; q++)
+							ri[j * KLANE + q] -= ri[k * KLANE + q] * rj[k * KLANE + q];
+					}
+				}
+#pragma omp simd
+				for (q = 0; q < KLANE; q++)
+					sum[q] = ri[i * KLANE + q];
+				for (j = 0; j < i; j++) {
+					rj = ap + PL(j, 0);
+#pragma omp simd
+					for (q = 0; q < KLANE; q++) {
+						ri[j * KLANE + q] /= rj[j * KLANE + q];
+						sum[q] -= ri[j * KLANE + q] * ri[j * KLANE + q] * rj[j * KLANE + q];
+					}
+				}
+
+				/* Free lanes with a pivot that is not positive */
+
+				for (q = 0; q < KLANE; q++) {
+					if (on[i * KLANE + q] && sum[q] <= tol[q]) {
+						for (k = 0; k < n[q]; k++)
+							on[k * KLANE + q] = 0;
+						cell[q] = -1;
+						nfree++;
+						sum[q] = 1;
+					}
+					ri[i * KLANE + q] = sum[q];
+				}
+			}
+			for (q = 0; q < KLANE; q++) {
+				if (fresh[q] != 1 || cell[q] < 0)
+					continue;
+				for (i = 0; i < n[q]; i++)
+					for (j = 0; j <= i; j++)
+						f[i * (i + 1) / 2 + j] = ap[PL(i, j) + q];
+				kfcache_put(idx + q * nsta, n[q], f, c[q]);
+			}
+		}
+
+		/* Otherwise take out the stations found in the last round:
+		   rank-one update of rows below msave, and row msave becomes a
+		   padding row */
+
+		else {
+			kmin = nmax;
+			for (q = 0; q < KLANE; q++) {
+				alpha[q] = 0;
+				for (i = 0; i < nmax; i++)
+					z[i * KLANE + q] = 0;
+				k = msave[q];
+				if (k < 0)
+					continue;
+				if (k < kmin)
+					kmin = k;
+				alpha[q] = ap[PL(k, k) + q];
+				for (i = k+1; i < nmax; i++) {
+					z[i * KLANE + q] = ap[PL(i, k) + q];
+					ap[PL(i, k) + q] = 0;
+				}
+				for (j = 0; j < k; j++)
+					ap[PL(k, j) + q] = 0;
+				ap[PL(k, k) + q] = 1;
+				msave[q] = -1;
+			}
+			for (j = kmin+1; j < nmax; j++) {
+				rj = ap + PL(j, 0);
+#pragma omp simd
+				for (q = 0; q < KLANE; q++) {
+					dj[q] = rj[j * KLANE + q] + alpha[q] * z[j * KLANE + q] *
+						z[j * KLANE + q];
+					beta[q] = z[j * KLANE + q] * alpha[q] / dj[q];
+					if (z[j * KLANE + q] != 0)
+						alpha[q] = alpha[q] * rj[j * KLANE + q] / dj[q];
+					rj[j * KLANE + q] = dj[q];
+				}
+				for (i = j+1; i < nmax; i++) {
+					ri = ap + PL(i, 0);
+#pragma omp simd
+					for (q = 0; q < KLANE; q++) {
+						z[i * KLANE + q] -= z[j * KLANE + q] * ri[j * KLANE + q];
+						ri[j * KLANE + q] += beta[q] * z[i * KLANE + q];
+					}
+				}
+			}
+		}
+
+		/* Solve M*u = 1 and M*v = d together */
+
+		for (i = 0; i < nmax; i++)
+			for (q = 0; q < KLANE; q++) {
+				if (on[i * KLANE + q]) {
+					bu[i * KLANE + q] = 1;
+					bv[i * KLANE + q] = dist_grid(cells[cell[q]], idx[q * nsta + i]);
+				}
+				else
+					bu[i * KLANE + q] = bv[i * KLANE + q] = 0;
+			}
+		for (i = 0; i < nmax; i++) {
+			for (j = 0; j < i; j++) {
+#pragma omp simd private(lij)
+				for (q = 0; q < KLANE; q++) {
+					lij = ap[PL(i, j) + q];
+					bu[i * KLANE + q] -= lij * bu[j * KLANE + q];
+					bv[i * KLANE + q] -= lij * bv[j * KLANE + q];
+				}
+			}
+		}
+		for (i = nmax-1; i >= 0; i--) {
+#pragma omp simd
+			for (q = 0; q < KLANE; q++) {
+				t[q] = 1.0 / ap[PL(i, i) + q];
+				bu[i * KLANE + q] *= t[q];
+				bv[i * KLANE + q] *= t[q];
+			}
+			for (j = i+1; j < nmax; j++) {
+#pragma omp simd private(lij)
+				for (q = 0; q < KLANE; q++) {
+					lij = ap[PL(j, i) + q];
+					bu[i * KLANE + q] -= lij * bu[j * KLANE + q];
+					bv[i * KLANE + q] -= lij * bv[j * KLANE + q];
+				}
+			}
+		}
+
+		/* Lagrange correction: m' = (1 + 1'*v) / (1'*u), w = m'*u - v */
+
+		for (q = 0; q < KLANE; q++) {
+			s[q] = 0;
+			t[q] = 1;
+		}
+		for (i = 0; i < nmax; i++)
+			for (q = 0; q < KLANE; q++) {
+				s[q] += bu[i * KLANE + q];
+				t[q] += bv[i * KLANE + q];
+			}
+		for (q = 0; q < KLANE; q++)
+			t[q] /= s[q];
+		for (i = 0; i < nmax; i++)
+#pragma omp simd
+			for (q = 0; q < KLANE; q++)
+				bv[i * KLANE + q] = t[q] * bu[i * KLANE + q] - bv[i * KLANE + q];
+
+		/* For each running cell, find the station with the highest
+		   elevation among those with negative weights (as in krige()),
+		   or mask the cell if there are none */
+
+		for (q = 0; q < KLANE; q++) {
+			if (cell[q] < 0)
+				continue;
+			elevsave = 0.0;
+			for (i = 0; i < n[q]; i++) {
+				if (on[i * KLANE + q] && bv[i * KLANE + q] < 0.0) {
+					if (elevations[idx[q * nsta + i]] > elevsave) {
+						msave[q] = i;
+						elevsave = elevations[idx[q * nsta + i]];
+					}
+				}
+			}
+			if (msave[q] >= 0) {
+				on[msave[q] * KLANE + q] = 0;
+				continue;
+			}
+			p = cell[q];
+			for (j = 0; j < nsta; j++)
+				w[(size_t) p * nsta + j] = 0.0;
+			for (i = 0; i < n[q]; i++) {
+				if (on[i * KLANE + q])
+					w[(size_t) p * nsta + idx[q * nsta + i]] = bv[i * KLANE + q];
+				on[i * KLANE + q] = 0;
+			}
+			done[p] = 1;
+			ndone++;
+			cell[q] = -1;
+			nfree++;
+		}
+	}
+	return(ndone);
+}
@@ -0,0 +1,244 @@
+/*
+ *    kfcache.c
+ *
+ *    Cache of factorizations of the kriging matrix, shared by all threads
+ *
+ *    When grid cells are kriged each with their own stations
+ *    (N-closest-stations, search-radius-km, or weight-engine = 1), the
+ *    matrix of distances among the stations depends only on which
+ *    stations are in use, and neighboring grid cells very often have
+ *    exactly the same set.  The LDL' factors of M = c*11' - G from the
+ *    symmetric solver (ldlsolv.c) are therefore kept, keyed by a bitmask
+ *    of the stations in the system (in station order), so that a grid
+ *    cell that arrives at a known set of stations only needs forward-
+ *    and backsubstitution.
+ *
+ *    The cache is a hash table of KFSET sets of KFWAY entries each.
+ *    Each set is guarded by one of KFLOCK locks, so threads working on
+ *    different sets do not wait for each other, and factors are copied
+ *    in and out under the lock.  Total memory is limited by the
+ *    factor-cache-mb setting; the least recently used entry of a set is
+ *    replaced when the set is full or the limit is reached.
+ */
+
+#include <malloc/malloc.h>
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dk_m.h"
+#include "dk_x.h"
+
+#define KFSET 4096                  /* number of sets in hash table */
+#define KFWAY 4                     /* number of entries in each set */
+#define KFLOCK 64                   /* number of locks */
+
+static struct {
+   unsigned long long key[NKWORD];  /* bitmask of stations */
+   int n;                           /* number of stations */
+   double c;                        /* shift of M */
+   double *f;                       /* packed factors of M */
+   long used;                       /* last use, for LRU replacement */
+} kfent[KFSET][KFWAY];
+static long kfclock[KFSET];         /* counter of lookups in each set */
+static omp_lock_t kflock[KFLOCK];   /* locks for sets */
+static int kfinit = 0;              /* 1 = locks initialized */
+static double kfbytes = 0;          /* memory held by cached factors */
+static long kfhit = 0;              /* number of cache hits */
+static long kfmiss = 0;             /* number of cache misses */
+static long kfdrop = 0;             /* number of entries replaced */
+
+/*
+ *    Bitmask of stations idx[0..n-1] and the set it belongs to
+ */
+
+static int kfcache_key(idx, n, key)
+int *idx;                        /* indexes of stations */
+int n;                           /* number of stations */
+unsigned long long *key;         /* bitmask of stations */
+{
+   unsigned long long h;         /* hash of bitmask */
+   int i;                        /* loop index */
+
+   memset(key, 0, NKWORD * sizeof(unsigned long long));
+   for (i = 0; i < n; i++)
+      key[idx[i] / 64] |= 1ULL << (idx[i] % 64);
+   h = 14695981039346656037ULL;
+   for (i = 0; i < NKWORD; i++) {
+      h ^= key[i];
+      h *= 1099511628211ULL;
+      h ^= h >> 29;
+   }
+   return((int) (h % KFSET));
+}
+
+/*
+ *    Initialize the locks; called once before the weights are computed
+ */
+
+void kfcache_init()
+{
+   int i;                        /* loop index */
+
+   if (kfinit == 1)
+      return;
+   for (i = 0; i < KFLOCK; i++)
+      omp_init_lock(&kflock[i]);
+   kfinit = 1;
+}
+
+/*
+ *    Look up the factors for stations idx[0..n-1] (in station order).  If
+ *    they are cached, copy them to the packed triangle ap and the shift
+ *    to c and return 1; otherwise return 0.
+ */
+
+int kfcache_get(idx, n, ap, c)
+int *idx;                        /* indexes of stations */
+int n;                           /* number of stations */
+double *ap;                      /* packed factors of M */
+double *c;                       /* shift */
+{
+   unsigned long long key[NKWORD];  /* bitmask of stations */
+   int b;                        /* set in hash table */
+   int e;                        /* entry in set */
+   int hit;                      /* 1 = factors found */
+
+   if (kfcmb <= 0 || kfinit == 0)
+      return(0);
+   b = kfcache_key(idx, n, key);
+   hit = 0;
+   omp_set_lock(&kflock[b % KFLOCK]);
+   kfclock[b]++;
+   for (e = 0; e < KFWAY; e++) {
+      if (kfent[b][e].f != NULL && kfent[b][e].n == n &&
+          memcmp(kfent[b][e].key, key, sizeof(key)) == 0) {
+         memcpy(ap, kfent[b][e].f, (size_t) n * (n + 1) / 2 * sizeof(double));
+         *c = kfent[b][e].c;
+         kfent[b][e].used = kfclock[b];
+         hit = 1;
+         break;
+      }
+   }
+   omp_unset_lock(&kflock[b % KFLOCK]);
+   if (hit == 1) {
+#pragma omp atomic
+      kfhit++;
+   }
+   else {
+#pragma omp atomic
+      kfmiss++;
+   }
+   return(hit);
+}
+
+/*
+ *    Add the factors for stations idx[0..n-1] (in station order) to the
+ *    cache
+ */
+
+void kfcache_put(idx, n, ap, c)
+int *idx;                        /* indexes of stations */
+int n;                           /* number of stations */
+double *ap;                      /* packed factors of M */
+double c;                        /* shift */
+{
+   unsigned long long key[NKWORD];  /* bitmask of stations */
+   int b;                        /* set in hash table */
+   int e;                        /* entry in set */
+   double held;                  /* memory held before these factors */
+   int lru;                      /* entry to replace */
+   double nbytes;                /* size of factors (bytes) */
+
+   if (kfcmb <= 0 || kfinit == 0)
+      return;
+   b = kfcache_key(idx, n, key);
+   nbytes = (double) n * (n + 1) / 2 * sizeof(double);
+   omp_set_lock(&kflock[b % KFLOCK]);
+
+   /* Replace an empty entry, the least recently used one, or the same
+      set of stations (put by another thread meanwhile) */
+
+   lru = 0;
+   for (e = 0; e < KFWAY; e++) {
+      if (kfent[b][e].f == NULL || (kfent[b][e].n == n &&
+          memcmp(kfent[b][e].key, key, sizeof(key)) == 0)) {
+         lru = e;
+         break;
+      }
+      if (kfent[b][e].used < kfent[b][lru].used)
+         lru = e;
+   }
+   if (kfent[b][lru].f != NULL) {
+      free(kfent[b][lru].f);
+      kfent[b][lru].f = NULL;
+#pragma omp atomic
+      kfbytes -= (double) kfent[b][lru].n * (kfent[b][lru].n + 1) / 2 *
+            sizeof(double);
+      if (e == KFWAY) {
+#pragma omp atomic
+         kfdrop++;
+      }
+   }
+
+   /* Reserve the memory (other threads update kfbytes under other
+      locks), and give it back if the cache is full */
+
+#pragma omp atomic capture
+   {
+      held = kfbytes;
+      kfbytes += nbytes;
+   }
+   if (held + nbytes > kfcmb * 1048576.) {
+#pragma omp atomic
+      kfbytes -= nbytes;
+   }
+   else {
+      kfent[b][lru].f = (double *) malloc((size_t) nbytes);
+      if (!kfent[b][lru].f) {
+         printf("\n\nAllocation failure in kfcache_put().\n");
+         exit(0);
+      }
+      memcpy(kfent[b][lru].f, ap, (size_t) nbytes);
+      memcpy(kfent[b][lru].key, key, sizeof(key));
+      kfent[b][lru].n = n;
+      kfent[b][lru].c = c;
+      kfent[b][lru].used = kfclock[b];
+   }
+   omp_unset_lock(&kflock[b % KFLOCK]);
+}
+
+/*
+ *    Write cache statistics: the number of station sets held and the
+ *    memory limit to main output file, and the lookups, hits, and
+ *    memory held to the screen.  Each station set is put in the cache
+ *    once, by whichever thread first needs it, so the number held is the
+ *    same for any number of threads unless the memory limit was reached;
+ *    which thread finds a set already there, and so the hit counts, are
+ *    not.
+ */
+
+void kfcache_report()
+{
+   int b, e;                     /* loop indexes */
+   long n;                       /* number of lookups */
+   int nheld;                    /* number of station sets held */
+
+   nheld = 0;
+   for (b = 0; b < KFSET; b++)
+      for (e = 0; e < KFWAY; e++)
+         if (kfent[b][e].f != NULL)
+            nheld++;
+   n = kfhit + kfmiss;
+   if (n == 0 && nheld == 0)
+      return;
+   fprintf(fpout, "\nKriging factorization cache (station sets of grid cells):\n");
+   fprintf(fpout, "   Station sets held %d  (limit %.0f MB)\n", nheld, kfcmb);
+   printf("\nKriging factorization cache (station sets of grid cells):\n");
+   printf("   Lookups %ld,  hits %ld,  misses %ld", n, kfhit, kfmiss);
+   if (n > 0)
+      printf("  (hit rate %.1f%%)", 100. * kfhit / n);
+   printf("\n   Entries replaced %ld,  memory %.1f MB (limit %.0f MB)\n",
+           kfdrop, kfbytes / 1048576., kfcmb);
+}
@@ -7,172 +7,570 @@
  *
  *    26 May 2000:
  *    Change solution method to LU decomposition
+ *
+ *    Modification, October 2026:
+ *       Added station availability flags so that weights can be computed
+ *       for timesteps where one or more stations have missing data
+ *
+ *    Modification, October 2026:
+ *       Work arrays come from the per-thread workspace of kwork_get()
+ *       instead of being allocated and freed on every call
+ *
+ *    Modification, October 2026:
+ *       N-closest-stations now limits the kriging system to the N
+ *       stations nearest the grid cell, found through the spatial
+ *       index of stations (staidx.c) instead of a full sort of the
+ *       distances
+ *
+ *    Modification, October 2026:
+ *       Added search-radius-km: only stations within the radius of the
+ *       grid cell are used, with a minimum and maximum number
+ *
+ *    Modification, October 2026:
+ *       Stations with negative weights are eliminated by downdating
+ *       the solution of the factored system (O(n^2) per station)
+ *       instead of refactoring the reduced system (O(n^3))
+ *
+ *    Modification, October 2026:
+ *       The system is solved by the symmetric solver of ldlsolv.c,
+ *       with LU decomposition as fallback (kriging-solver setting)
+ *
+ *    Modification, October 2026:
+ *       The choice of stations for a grid cell is split out into
+ *       krige_stations(), which the batched solver (kbatch.c) shares
+ *
+ *    Modification, October 2026:
+ *       Added the mixed-precision symmetric solver (kriging-solver = 4),
+ *       with the residual of the final kriging equations recorded for
+ *       each grid cell
+ *
+ *    Modification, October 2026:
+ *       Factors from the symmetric solver are shared among grid cells
+ *       with the same set of stations through the factorization cache
+ *       (kfcache.c)
+ *
+ *    Modification, October 2026:
+ *       Added elimination-warm-start: the elimination of stations with
+ *       negative weights starts from the stations that survived it at
+ *       the previous grid cell, adding stations back when needed
+ *
+ *    Modification, October 2026:
+ *       Added krige_var() for the kriging variance of a grid cell
+ *
+ *    Modification, October 2026:
+ *       Distances from the grid cell to its stations are computed on
+ *       entry (dist_grid()) instead of taken from the matrix dgrid,
+ *       which is no longer kept
  */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <malloc/malloc.h>
+#include <math.h>
 
 #include "dk_x.h"
 
-double *krige(l, nsta, ad, dgrid, elevations, w)
+#define KWARM 2                  /* rounds of adding stations back before
+                                    a warm start gives up */
+
+int ludcmp();                    /* lu decomposition function */
+void lubksbm();                  /* lu backsubstitution, many r.h.s. */
+
+/*
+ *    Find the stations to use for grid cell l and put their indexes in
+ *    idx (in station order).  Returns the number of stations.
+ */
+
+int krige_stations(l, nsta, avail, idx, dist)
+int l;                           /* grid index */
+int nsta;                        /* number of stations */
+int *avail;                      /* station availability flags (NULL = all) */
+int *idx;                        /* indexes of stations to use */
+float *dist;                     /* scratch space for distances (nsta) */
+{
+	int itemp;                    /* temporary variable */
+	int m, n;                     /* loop indexes */
+	int ns;                       /* number of stations */
+
+	/* Use the stations that have data, limited to those within the
+	   search radius of the grid cell if search-radius-km is set (but no
+	   fewer than the nearest sradmin and no more than the nearest
+	   sradmax), or else to the N closest if N-closest-stations is set.
+	   Neighbors are found through the spatial index of stations. */
+
+	if (srad > 0) {
+		ns = staidx_radius(grid[l].north, grid[l].east, srad, avail, idx,
+				dist);
+		if (ns < sradmin)
+			ns = staidx_nearest(grid[l].north, grid[l].east, sradmin, avail,
+					idx, dist);
+		else if (sradmax > 0 && ns > sradmax) {
+			selectn(dist, idx, ns, sradmax);
+			ns = sradmax;
+		}
+	}
+	else if (N > 0 && N < nsta)
+		ns = staidx_nearest(grid[l].north, grid[l].east, N, avail, idx,
+				dist);
+	else {
+		ns = 0;
+		for (m = 0; m < nsta; m++)
+			if (avail == NULL || avail[m] == 1)
+				idx[ns++] = m;
+	}
+
+	/* Put stations in station order */
+
+	for (m = 1; m < ns; m++) {
+		itemp = idx[m];
+		for (n = m - 1; n >= 0 && idx[n] > itemp; n--)
+			idx[n+1] = idx[n];
+		idx[n+1] = itemp;
+	}
+
+	return(ns);
+}
+
+/*
+ *    Load the bordered kriging matrix for stations idx[0..ns-1] and grid
+ *    cell l into the workspace and solve it by LU decomposition.  The LU
+ *    factors stay in kw->a and kw->indx for later backsubstitution.
+ */
+
+static void krige_lu(l, ns, idx, ad, dg, kw, x)
+int l;                           /* grid index */
+int ns;                          /* number of stations */
+int *idx;                        /* indexes of stations */
+float **ad;                      /* distances between stations */
+float *dg;                       /* distances between grid cell and
+                                    stations (by station index) */
+struct kwork *kw;                /* scratch space of this thread */
+double *x;                       /* solution (weights and multiplier) */
+{
+	double *a;                    /* bordered matrix (LU factors) */
+	int lda;                      /* row length of a */
+	int m, mm, nn;                /* loop indexes */
+	int nsp1;                     /* ns plus 1 */
+
+	a = kw->a;
+	lda = kw->lda;
+	nsp1 = ns + 1;
+	for (mm = 0; mm < ns; mm++) {
+		m = idx[mm];
+		for (nn = 0; nn < ns; nn++)
+			a[mm * lda + nn] = ad[m][idx[nn]];
+		a[mm * lda + ns] = a[ns * lda + mm] = 1;
+		a[mm * lda + nsp1] = dg[m];
+	}
+	a[ns * lda + ns] = 0;
+	a[ns * lda + nsp1] = 1;
+
+	if (lusolv(nsp1, a, lda, x, kw->indx, kw->vv) != 0) {
+		if (icoord == 1)
+			fprintf(fpout, "\n\n%s\n%s%d%s%5.2f%s%6.2f%s%6.0f\n\n%s\n",
+					"Indeterminate linear system ... ",
+					"   Grid cell ", l+1, ":  lat ", grid[l].north,
+					"   long ", grid[l].east, "   elev ", grid[l].elev*1000,
+					"Program terminating ...");
+		else
+			fprintf(fpout, "\n\n%s\n%s%d%s%10.2f%s%10.2f%s%6.0f\n\n%s\n",
+					"Indeterminate linear system ... ",
+					"   Grid cell ", l+1, ":  northing ", grid[l].north,
+					"   easting ", grid[l].east, "   elev ", grid[l].elev*1000,
+					"Program terminating ...");
+		exit(0);
+	}
+}
+
+/*
+ *    Kriging variance at grid cell l for weights w of stations ista[0..ns-1]
+ *    (NULL = all stations):  w'*d + mu, where d holds the distances from
+ *    the grid cell (the variogram is linear with unit slope).  The
+ *    Lagrange multiplier mu follows from the kriging equation of the
+ *    station with the largest weight, which is in use.
+ */
+
+double krige_var(l, ns, ista, w)
+int l;                           /* grid index */
+int ns;                          /* number of stations */
+int *ista;                       /* indexes of stations (NULL = all) */
+float *w;                        /* weights */
+{
+	int i, j;                     /* loop indexes */
+	int mi, mj;                   /* station indexes */
+	double mu;                    /* Lagrange multiplier */
+	double v;                     /* kriging variance */
+
+	j = 0;
+	for (i = 1; i < ns; i++)
+		if (w[i] > w[j])
+			j = i;
+	mj = (ista != NULL) ? ista[j] : j;
+	mu = dist_grid(l, mj);
+	v = 0;
+	for (i = 0; i < ns; i++) {
+		mi = (ista != NULL) ? ista[i] : i;
+		mu -= ad[mj][mi] * w[i];
+		if (w[i] != 0)
+			v += w[i] * dist_grid(l, mi);
+	}
+	return(v + mu);
+}
+
+/*
+ *    Record the largest residual of the kriging equations for stations
+ *    idx[mm] with act[mm] = 1 and solution x (weights in x[0..nf-1],
+ *    Lagrange multiplier in x[nf]), relative to the largest distance
+ *    from the grid cell for the station rows
+ */
+
+static void krige_resid(l, nf, idx, act, dg, x)
+int l;                           /* grid index */
+int nf;                          /* number of stations in factored system */
+int *idx;                        /* indexes of stations */
+int *act;                        /* flags for stations in use */
+float *dg;                       /* distances between grid cell and
+                                    stations (by station index) */
+double *x;                       /* solution (weights and multiplier) */
+{
+	double dmax;                  /* largest distance from grid cell */
+	int mm, nn;                   /* loop indexes */
+	double r;                     /* residual of one equation */
+	double rmax;                  /* largest relative residual */
+	double wsum;                  /* sum of weights */
+
+	dmax = 0;
+	for (mm = 0; mm < nf; mm++)
+		if (act[mm] == 1 && dg[idx[mm]] > dmax)
+			dmax = dg[idx[mm]];
+	if (dmax <= 0)
+		dmax = 1;
+	rmax = 0;
+	wsum = 0;
+	for (mm = 0; mm < nf; mm++) {
+		if (act[mm] == 0)
+			continue;
+		wsum += x[mm];
+		r = x[nf] - dg[idx[mm]];
+		for (nn = 0; nn < nf; nn++)
+			if (act[nn] == 1)
+				r += ad[idx[mm]][idx[nn]] * x[nn];
+		if (fabs(r) / dmax > rmax)
+			rmax = fabs(r) / dmax;
+	}
+	if (fabs(wsum - 1) > rmax)
+		rmax = fabs(wsum - 1);
+	if (rmax > kresid[l])
+		kresid[l] = (float) rmax;
+}
+
+double *krige(l, nsta, ad, elevations, avail, w)
 int l;                           /* grid index */
 int nsta;                          /* number of stations used */
 float **ad;                      /* matrix of distances between prec/temp
                                     stations for computing kriging weights */
-float **dgrid;                   /* matrix of distances between grid cells
-                                    and prec/temp stations */
-int *elevations;				 /* vector of station elevations */
+float *elevations;				 /* vector of station elevations */
+int *avail;                      /* station availability flags (1 = station
+                                    has data, 0 = missing; NULL = all) */
 double *w;                    /* kriging weights */
 {
 	float elevsave;               /* stored value of station elevation */
-	int m, mm, n, nn, i, j;             /* loop indexes */
-	int msave;                    /* stored value of m index */
-	int nsp1;                     /* ns plus 1 */
+	double *c;                    /* inverse at removed stations, G(S,S) */
+	int *cand;                    /* indexes of candidate stations, in
+	                                 station order (warm start) */
+	double cs;                    /* shift from ldlfact() */
+	float d;                      /* +/- 1 from ludcmp() (not used) */
+	int i, j, m, mm, nn;          /* loop indexes */
+	double dmax;                  /* largest distance from grid cell */
+	float *dg;                    /* distances between grid cell and
+	                                 stations (by station index) */
+	int msave;                    /* stored value of mm index */
+	int nadd;                     /* number of stations added back */
+	int nc;                       /* number of candidate stations */
+	int nnew;                     /* number of stations after adding back */
+	int round;                    /* rounds of adding stations back */
+	double r;                     /* residual of kriging equation for a
+	                                 station not in use */
+	int warm;                     /* 1 = started from the stations of the
+	                                 previous grid cell */
+	int *act;                     /* flags for factored stations still in use */
+	int nf;                       /* number of stations in factored system */
+	int nrem;                     /* number of stations removed since
+	                                 factoring */
+	double *p;                    /* packed factors from symmetric solver */
+	int *rem;                     /* positions of removed stations */
+	double s;                     /* 1'*inv(M)*1 from ldlfact() */
+	int sym;                      /* 1 = factored by symmetric solver */
+	double *u;                    /* inv(M)*1 from ldlfact() */
+	double *x0;                   /* solution of factored system */
+	double *y;                    /* inv(G(S,S)) * x(S) */
+	double *z;                    /* columns of inverse for removed stations,
+	                                 G(:,S) (column j starts at z[j*lda]) */
+	struct kwork *kw;             /* scratch space of this thread */
+	int lda;                      /* row length of a */
 	double *wcalc;                /* calculation vector for weights */
 	int ns;					 	 /* number of stations */
-	int luret;                    /* return value from lusolv() */
-	int *staflg;				 	 /* station use flags*/
-	float temp;						 /* temporary variable */
-	int itemp;						 /* temporary variable */
-	float *dist;					 /* sorted distance */
-	int *idx;					 /* index sorted distance */
-	double **a;                   /* data matrix for solving for kriging
-                                       weights (input to m_inv()) */
-//	double *w;                    /* kriging weights */
-//	double w[nsta+1];
-
-	//   nsta = ns;
-
-	// find the N closest stations
-	dist = vector(nsta);
-	idx = ivector(nsta);
-	for (i = 0; i < nsta; ++i){
-		dist[i] = dgrid[l][i];
-		idx[i] = i;
-	}
-	for (i = 0; i < nsta; ++i){
-		for (j = i + 1; j < nsta; ++j){
-			if (dist[i] > dist[j]) {
-				// sort the distance
-				temp = dist[i];
-				dist[i] = dist[j];
-				dist[j] = temp;
-
-				// re-sort the index
-				itemp = idx[i];
-				idx[i] = idx[j];
-				idx[j] = itemp;
-			}
+	int *idx;					 /* indexes of stations in use, in station
+	                                 order */
+	double *a;                    /* data matrix for solving for kriging
+                                       weights (row i starts at a[i*lda]) */
+
+	kw = kwork_get(nsta);
+	a = kw->a;
+	lda = kw->lda;
+	wcalc = kw->wcalc;
+	idx = kw->idx;
+	act = kw->act;
+	rem = kw->rem;
+	x0 = kw->x0;
+	y = kw->y;
+	z = kw->z;
+	p = kw->p;
+	u = kw->u;
+	c = kw->c;
+	cand = kw->cand;
+	dg = kw->dg;
+
+	ns = krige_stations(l, nsta, avail, idx, kw->dist);
+	for (mm = 0; mm < ns; mm++)
+		dg[idx[mm]] = dist_grid(l, idx[mm]);
+
+	/* With elimination-warm-start, begin with those of the stations
+	   that survived elimination at the previous grid cell in raster
+	   order (set by the weight engine, which clears the set when that
+	   cell was not solved here), if that leaves out any of them;
+	   stations are added back below when needed.  The set is cleared
+	   until this cell is finished, so that a cell that fails passes
+	   nothing on. */
+
+	warm = 0;
+	round = 0;
+	nc = ns;
+	if (iwarm == 1 && kw->nfin > 0) {
+		for (mm = 0; mm < nc; mm++)
+			cand[mm] = idx[mm];
+		ns = 0;
+		nn = 0;
+		for (mm = 0; mm < nc; mm++) {
+			while (nn < kw->nfin && kw->fin[nn] < cand[mm])
+				nn++;
+			if (nn < kw->nfin && kw->fin[nn] == cand[mm])
+				idx[ns++] = cand[mm];
+		}
+		if (ns > 0 && ns < nc)
+			warm = 1;
+		else {
+			for (mm = 0; mm < nc; mm++)
+				idx[mm] = cand[mm];
+			ns = nc;
 		}
 	}
+	kw->nfin = 0;
 
+	/* Factor the system for the stations in use, then eliminate stations
+	   with negative weights by downdating the solution instead of
+	   refactoring.  If G is the inverse of the factored matrix and S the
+	   set of removed stations, the solution x' of the reduced system
+	   follows from the solution x of the factored one as
 
-	// set station use flags
-	ns = 0;
-	staflg = ivector(nsta);
-	for (m = 0; m < nsta; m++) {
-		staflg[idx[m]] = 1;
-		ns++;
-	}
-	//   for (i = 0; i < nsta; ++i){
-	//	   printf("%f - %i - %i\n",dist[i],idx[i],staflg[i]);
-	//   }
-	//   exit(0);
+	      x' = x - G(:,S) * inv(G(S,S)) * x(S)
 
-	a = dmatrix(nsta+1, nsta+2);
-//	w = dvector(nsta+1);
+	   Each removal costs one forward- and backsubstitution for column s
+	   of G plus a solve with the small matrix G(S,S).  After many
+	   removals the reduced system is refactored. */
 
-	wcalc = dvector(nsta+1);
+	nf = 0;
+	nrem = 0;
 	while (1) {
-		nsp1 = ns + 1;
-
-		/* Load matrix for calculating kriging weights using only
-         the desired stations (staflg = 1) */
-
-		mm = -1;
-		for (m = 0; m < nsta; m++) {
-			if (staflg[m] == 1) {
-				mm++;
-				nn = -1;
-				for (n = 0; n < nsta; n++) {
-					if (staflg[n] == 1) {
-						nn++;
-						a[mm][nn] = ad[m][n];
-					}
+		if (nf == 0) {
+			nf = ns;
+
+			/* Load matrix for calculating kriging weights using only
+			   the desired stations (idx[0..ns-1]), and solve the
+			   linear system for kriging weights -- by the symmetric
+			   solver if it applies, otherwise by LU decomposition */
+
+			sym = 0;
+			if (isolv != 1) {
+				for (mm = 0; mm < ns; mm++)
+					for (nn = 0; nn <= mm; nn++)
+						p[mm * (mm + 1) / 2 + nn] = ad[idx[mm]][idx[nn]];
+				if (isolv == 4)
+					sym = (ldlfactf(p, kw->pf, ns, u, &s, &cs, kw->rw) == 0);
+
+				/* (Factors from the cache need only inv(M)*1) */
+
+				else if (kfcache_get(idx, ns, p, &cs) == 1) {
+					sym = 1;
+					for (mm = 0; mm < ns; mm++)
+						u[mm] = 1;
+					ldlbksbm(p, ns, u, 1);
+					s = 0;
+					for (mm = 0; mm < ns; mm++)
+						s += u[mm];
+				}
+				else {
+					sym = (ldlfact(p, ns, u, &s, &cs) == 0);
+					if (sym == 1)
+						kfcache_put(idx, ns, p, cs);
 				}
-				a[mm][ns] = a[ns][mm] = 1;
-				a[mm][nsp1] = dgrid[l][m];
+				if (sym == 1) {
+					for (mm = 0; mm < ns; mm++)
+						x0[mm] = dg[idx[mm]];
+					x0[ns] = 1;
+					if (isolv == 4)
+						ldlsolvm(p, kw->pf, ns, u, s, cs, x0, kw->rw);
+					else
+						ldlsolv(p, ns, u, s, cs, x0, 1);
+				}
+			}
+			if (sym == 0)
+				krige_lu(l, ns, idx, ad, dg, kw, x0);
+
+			/* (kriging-solver = 3: check symmetric solution against LU) */
+
+			else if (isolv == 3) {
+				krige_lu(l, ns, idx, ad, dg, kw, wcalc);
+				ldlcheck(x0, wcalc, ns, 1);
 			}
+			for (mm = 0; mm < ns; mm++)
+				act[mm] = 1;
+			nrem = 0;
 		}
-		a[ns][ns] = 0;
-		a[ns][nsp1] = 1;
-		n = nsp1;
-
-		/* Solve linear system for kriging weights */
-
-		if ((luret = lusolv(n, a, wcalc)) != 0) {
-			if (icoord == 1)
-				fprintf(fpout, "\n\n%s\n%s%d%s%5.2f%s%6.2f%s%6.0f\n\n%s\n",
-						"Indeterminate linear system ... ",
-						"   Grid cell ", l+1, ":  lat ", grid[l].north,
-						"   long ", grid[l].east, "   elev ", grid[l].elev*1000,
-						"Program terminating ...");
-			else
-				fprintf(fpout, "\n\n%s\n%s%d%s%10.2f%s%10.2f%s%6.0f\n\n%s\n",
-						"Indeterminate linear system ... ",
-						"   Grid cell ", l+1, ":  northing ", grid[l].north,
-						"   easting ", grid[l].east, "   elev ", grid[l].elev*1000,
-						"Program terminating ...");
-			exit(0);
+
+		/* Weights with the removed stations taken out */
+
+		for (mm = 0; mm <= nf; mm++)
+			wcalc[mm] = x0[mm];
+		if (nrem > 0) {
+			for (i = 0; i < nrem; i++) {
+				for (j = 0; j < nrem; j++)
+					c[i * nrem + j] = z[j * lda + rem[i]];
+				y[i] = x0[rem[i]];
+			}
+			if (ludcmp(c, nrem, nrem, kw->cindx, &d, kw->cvv) != 0) {
+
+				/* (Should not happen unless the reduced system is
+				   singular; refactoring it reports the problem) */
+
+				nf = 0;
+				continue;
+			}
+			lubksbm(c, nrem, nrem, kw->cindx, y, 1);
+			for (j = 0; j < nrem; j++)
+				for (mm = 0; mm <= nf; mm++)
+					wcalc[mm] -= z[j * lda + mm] * y[j];
+			for (j = 0; j < nrem; j++)
+				wcalc[rem[j]] = 0.0;
 		}
 
 		/* Check for negative weights, throw out the most distant station by elevation with
          a negative weight, and recalculate weights until all are positive */
 
 		elevsave = 0.0;
-		mm = msave = -1;
-		for (m = 0; m < nsta; m++) {
-			if (staflg[m] == 1) {
-				mm++;
-				if (wcalc[mm] < 0.0) {
-					if (elevations[m] > elevsave) {
-						msave = m;
-						elevsave = elevations[m];
-					}
+		msave = -1;
+		for (mm = 0; mm < nf; mm++) {
+			if (act[mm] == 1 && wcalc[mm] < 0.0) {
+				if (elevations[idx[mm]] > elevsave) {
+					msave = mm;
+					elevsave = elevations[idx[mm]];
 				}
 			}
 		}
-		if (msave >= 0) {
-			staflg[msave] = 0; // set station use flag to zero for furthest station
-			ns--;
-		}
-		else {
-			mm = -1;
-			for (m = 0; m < nsta; m++) {
-				if (staflg[m] == 1) {
-					mm++;
-					w[m] = wcalc[mm];
+
+		/* (Warm start: a candidate station not in use would take a
+		   positive weight if added back when the residual of its
+		   kriging equation, sum(G(s,:)*w) + mu - d(s), is positive,
+		   since the kriging variance at s is positive.  Add back all
+		   such stations and eliminate again; after KWARM rounds,
+		   start over from all of the candidate stations.) */
+
+		if (msave < 0 && warm == 1) {
+			dmax = 0;
+			for (mm = 0; mm < nf; mm++)
+				if (act[mm] == 1 && dg[idx[mm]] > dmax)
+					dmax = dg[idx[mm]];
+			nadd = 0;
+			nnew = 0;
+			nn = 0;
+			for (i = 0; i < nc; i++) {
+				m = cand[i];
+				while (nn < nf && idx[nn] < m)
+					nn++;
+				if (nn < nf && idx[nn] == m && act[nn] == 1) {
+					rem[nnew++] = m;
+					continue;
+				}
+				r = wcalc[nf] - dg[m];
+				for (mm = 0; mm < nf; mm++)
+					if (act[mm] == 1)
+						r += ad[m][idx[mm]] * wcalc[mm];
+				if (r > 1e-9 * dmax) {
+					rem[nnew++] = m;
+					nadd++;
 				}
-				else
-					w[m] = 0.0;
+			}
+			if (nadd > 0) {
+				if (++round > KWARM) {
+					warm = 0;
+					for (mm = 0; mm < nc; mm++)
+						idx[mm] = cand[mm];
+					ns = nc;
+				}
+				else {
+					for (mm = 0; mm < nnew; mm++)
+						idx[mm] = rem[mm];
+					ns = nnew;
+				}
+				nf = 0;
+				continue;
+			}
+		}
+		if (msave < 0) {
+			for (m = 0; m < nsta; m++)
+				w[m] = 0.0;
+			for (mm = 0; mm < nf; mm++)
+				if (act[mm] == 1)
+					w[idx[mm]] = wcalc[mm];
+			if (isolv == 4)
+				krige_resid(l, nf, idx, act, dg, wcalc);
+
+			/* (Stations left, for the warm start of the next cell) */
+
+			if (iwarm == 1) {
+				kw->nfin = 0;
+				for (mm = 0; mm < nf; mm++)
+					if (act[mm] == 1)
+						kw->fin[kw->nfin++] = idx[mm];
 			}
 			break;
 		}
-	}
+		act[msave] = 0; // drop the furthest station
+		ns--;
 
-	/* clean up 1D arrays*/
-	free(dist);
-	free(idx);
-	free(staflg);
-	free(wcalc);
+		/* Refactor after removing half of the factored stations;
+		   otherwise add column msave of the inverse */
 
-	/* clean up 2D arrays*/
-	for (m = 0; m < nsta+1; m++) {
-		free(a[m]);
+		if (nrem + 1 > nf / 2) {
+			ns = 0;
+			for (mm = 0; mm < nf; mm++)
+				if (act[mm] == 1)
+					idx[ns++] = idx[mm];
+			nf = 0;
+		}
+		else {
+			for (mm = 0; mm <= nf; mm++)
+				z[nrem * lda + mm] = 0.0;
+			z[nrem * lda + msave] = 1.0;
+			if (sym == 1 && isolv == 4)
+				ldlsolvm(p, kw->pf, nf, u, s, cs, z + nrem * lda, kw->rw);
+			else if (sym == 1)
+				ldlsolv(p, nf, u, s, cs, z + nrem * lda, 1);
+			else
+				lubksbm(a, nf + 1, lda, kw->indx, z + nrem * lda, 1);
+			rem[nrem++] = msave;
+		}
 	}
-	free(a);
 
-//	return w;
+	return w;
 }
-
@@ -0,0 +1,196 @@
+/*
+ *    kwcache.c
+ *
+ *    Cache of kriging weight sets for timesteps with missing stations
+ *
+ *    When one or more stations have missing data, the kriging weights
+ *    for every grid cell have to be recalculated without those stations.
+ *    The weights depend only on which stations are present, and over a
+ *    long run the same few patterns of missing stations occur over and
+ *    over.  The complete weight matrix (used grid cells x available
+ *    stations) for each pattern is therefore kept in memory, keyed by a
+ *    bitmask of the available stations, so that each pattern is solved
+ *    only once.  Total memory is limited by the weight-cache-mb setting;
+ *    when the limit is reached, the least recently used weight set is
+ *    dropped.  A weight set larger than the limit by itself is kept only
+ *    when it is the only one in the cache (a warning is written the
+ *    first time), so that a run of timesteps with its pattern still
+ *    solves it once.  With kriging-variance, each weight set also holds the
+ *    kriging variance of each used grid cell, after the weights.
+ *
+ *    The timestep loops fetch the weight sets for a batch of timesteps
+ *    before kriging the timesteps in parallel, so a set handed out is
+ *    pinned until it is given back with kwcache_release(), and only
+ *    sets that are not pinned are dropped.  A set that cannot be cached
+ *    (every cached set pinned, or too large with another set pinned) is
+ *    computed into its own space, which kwcache_release() frees.
+ */
+
+#include <malloc/malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dk_m.h"
+#include "dk_x.h"
+
+#define MKWSET 256                  /* maximum number of cached weight sets */
+
+static struct {
+   unsigned long long key[NKWORD];  /* bitmask of available stations */
+   int ns;                          /* number of available stations */
+   float *wt;                       /* weights (ngriduse x ns), followed
+                                       by kriging variances (ngriduse) if
+                                       kriging-variance is set */
+   long used;                       /* last use, for LRU replacement */
+   int pin;                         /* number of users holding the set */
+} kwset[MKWSET];
+static int nkwset = 0;              /* number of weight sets in cache */
+static long kwclock = 0;            /* counter of cache lookups */
+static double kwbytes = 0;          /* memory held by cached weight sets */
+static long kwhit = 0;              /* number of cache hits */
+static long kwmiss = 0;             /* number of cache misses */
+static int kwwarn = 0;              /* 1 = warning for weight set larger
+                                       than cache written */
+
+/*
+ *    Return the weight matrix for the given station availability pattern,
+ *    computing it if it is not already in the cache.  Row u of the matrix
+ *    holds the weights for grid cell iuse[u], one for each available
+ *    station in station order.  The matrix must be given back with
+ *    kwcache_release() when it is no longer needed.
+ */
+
+float *kwcache_get(avail, ns)
+int *avail;                      /* station availability flags */
+int ns;                          /* number of available stations */
+{
+   unsigned long long key[NKWORD];  /* bitmask of available stations */
+   double limit;                 /* cache size limit (bytes) */
+   int i, n;                     /* loop indexes */
+   int lru;                      /* index of least recently used set */
+   double nbytes;                /* size of weight set (bytes) */
+   float *wt;                    /* weight set not cached */
+
+   memset(key, 0, sizeof(key));
+   for (i = 0; i < nsta; i++)
+      if (avail[i] == 1)
+         key[i / 64] |= 1ULL << (i % 64);
+
+   kwclock++;
+   for (n = 0; n < nkwset; n++) {
+      if (memcmp(kwset[n].key, key, sizeof(key)) == 0) {
+         kwset[n].used = kwclock;
+         kwset[n].pin++;
+         kwhit++;
+         return(kwset[n].wt);
+      }
+   }
+   kwmiss++;
+
+   /* Drop least recently used weight sets that are not pinned until the
+      new one fits (or, if it is larger than the limit, until none is
+      left) */
+
+   limit = kwcmb * 1048576.;
+   nbytes = (double) ngriduse * (ns + ivar) * sizeof(float);
+   if (nbytes > limit && limit > 0 && kwwarn == 0) {
+      printf("\nWARNING - a kriging weight set takes %.1f MB, more than weight-cache-mb (%.1f MB);\n",
+             nbytes / 1048576., kwcmb);
+      printf("only one weight set at a time is kept for re-use\n");
+      kwwarn = 1;
+   }
+   while (limit > 0 && (nkwset == MKWSET || kwbytes + nbytes > limit)) {
+      lru = -1;
+      for (n = 0; n < nkwset; n++)
+         if (kwset[n].pin == 0 && (lru < 0 || kwset[n].used < kwset[lru].used))
+            lru = n;
+      if (lru < 0)
+         break;
+      free(kwset[lru].wt);
+      kwbytes -= (double) ngriduse * (kwset[lru].ns + ivar) * sizeof(float);
+      kwset[lru] = kwset[--nkwset];
+   }
+
+   /* A weight set that does not fit is computed into its own space and
+      not kept */
+
+   if (limit <= 0 || nkwset == MKWSET ||
+       (kwbytes + nbytes > limit && nkwset > 0)) {
+      wt = (float *) malloc((size_t) ngriduse * (ns + ivar) * sizeof(float));
+      if (!wt) {
+         printf("\n\nAllocation failure in kwcache_get().\n");
+         exit(0);
+      }
+      kweng(avail, ns, wt, NULL, (ivar == 1) ?
+            wt + (size_t) ngriduse * ns : NULL);
+      return(wt);
+   }
+
+   n = nkwset;
+   kwset[n].wt = (float *) malloc((size_t) ngriduse * (ns + ivar) *
+         sizeof(float));
+   if (!kwset[n].wt) {
+      printf("\n\nAllocation failure in kwcache_get().\n");
+      exit(0);
+   }
+   memcpy(kwset[n].key, key, sizeof(key));
+   kwset[n].ns = ns;
+   kwset[n].used = kwclock;
+   kwset[n].pin = 1;
+   kwbytes += nbytes;
+   nkwset++;
+
+   kweng(avail, ns, kwset[n].wt, NULL, (ivar == 1) ?
+         kwset[n].wt + (size_t) ngriduse * ns : NULL);
+   return(kwset[n].wt);
+}
+
+/*
+ *    Return 1 if a weight matrix from kwcache_get() is held in the cache,
+ *    0 if it has space of its own
+ */
+
+int kwcache_held(wt)
+float *wt;                       /* weight matrix */
+{
+   int n;                        /* loop index */
+
+   for (n = 0; n < nkwset; n++)
+      if (kwset[n].wt == wt)
+         return(1);
+   return(0);
+}
+
+/*
+ *    Give back a weight matrix from kwcache_get()
+ */
+
+void kwcache_release(wt)
+float *wt;                       /* weight matrix */
+{
+   int n;                        /* loop index */
+
+   for (n = 0; n < nkwset; n++) {
+      if (kwset[n].wt == wt) {
+         kwset[n].pin--;
+         return;
+      }
+   }
+   free(wt);
+}
+
+/*
+ *    Write cache statistics to main output file
+ */
+
+void kwcache_report()
+{
+   fprintf(fpout, "\nKriging weight cache (missing-station patterns):\n");
+   fprintf(fpout, "   Lookups %ld,  hits %ld,  misses %ld", kwclock, kwhit,
+           kwmiss);
+   if (kwclock > 0)
+      fprintf(fpout, "  (hit rate %.1f%%)", 100. * kwhit / kwclock);
+   fprintf(fpout, "\n   Weight sets held %d,  memory %.1f MB (limit %.0f MB)\n",
+           nkwset, kwbytes / 1048576., kwcmb);
+}
@@ -0,0 +1,404 @@
+/*
+ *    kweng.c
+ *
+ *    Kriging weight engine -- compute kriging weights for all used grid
+ *    cells for one set of available stations
+ *
+ *    The left-hand side of the kriging system (distances among the
+ *    stations plus the Lagrange row and column) is the same for every
+ *    grid cell; only the right-hand side (distances from the grid cell
+ *    to the stations) changes.  With weight-engine = 2 (the default),
+ *    the station matrix is therefore factored once, and the right-hand
+ *    sides of blocks of grid cells are solved together by forward- and
+ *    backsubstitution (by the symmetric solver of ldlsolv.c, unless
+ *    kriging-solver = 1 or the matrix is unsuitable for it, in which
+ *    case by LU decomposition; with USE_LAPACK the symmetric solver uses
+ *    a Cholesky factor from LAPACK).  This reduces the work from
+ *    O(ngrid * n^3) to O(n^3 + ngrid * n^2).  The distances for the
+ *    right-hand sides are computed by dist_grid_row() as each block is
+ *    loaded, not kept for all grid cells.  With weight-engine = 3, the inverse G of the
+ *    station distance matrix, G*1, and 1'*G*1 are computed once instead,
+ *    and the weights for each grid cell follow in closed form from two
+ *    matrix-vector products plus the correction for the Lagrange
+ *    multiplier:
+ *
+ *       v = G*d,   w = v + G*1 * (1 - 1'*v) / (1'*G*1)
+ *
+ *    where d is the vector of distances from the grid cell to the
+ *    stations.  Grid cells whose weights include negative values go
+ *    through krige(), which eliminates stations one at a time.  With
+ *    weight-engine = 1, or when N-closest-stations or search-radius-km
+ *    gives each grid cell its own subset of the stations, krige() is
+ *    called for every grid cell.  With the symmetric solver
+ *    (kriging-solver = 2), those grid cells -- the cells with negative
+ *    weights of a block, or all of its cells -- are solved KLANE at a
+ *    time by kbatch() instead, and only the ones it cannot finish go
+ *    through krige().  With the mixed-precision solver
+ *    (kriging-solver = 4), every grid cell goes through krige(), which
+ *    records its residual.
+ *    With elimination-warm-start, kbatch() is not used, and krige()
+ *    starts each grid cell from the stations left at the used grid cell
+ *    before it in raster order, if that cell is in the same block and
+ *    went through krige() too.  With kriging-variance, the kriging
+ *    variance of each grid cell is computed from its weights as well.
+ *
+ *    Only the used grid cells (iuse) are visited.  They are handed out
+ *    to the threads in blocks by a dynamic schedule, since the cost of a
+ *    cell varies greatly with the number of stations that have to be
+ *    eliminated.  The blocks are always KBLK cells, whatever the number
+ *    of threads: the cells that kbatch() solves together and the warm
+ *    start of krige() depend on the block, and so the weights do not
+ *    depend on the number of threads or on which thread takes which
+ *    block.  The time each thread spends on its blocks is accumulated
+ *    over all calls and written to the screen by kweng_report(); it
+ *    varies from run to run, so it is kept out of the main output file.
+ */
+
+#include <malloc/malloc.h>
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "dk_m.h"
+#include "dk_x.h"
+
+#define KBLK 64                  /* number of grid cells solved together */
+
+static double *kwbusy = NULL;    /* time spent on blocks by each thread (s) */
+static double *kwcell;           /* number of grid cells done by each thread */
+static int kwnt;                 /* number of threads with timing entries */
+static double kwwall = 0;        /* elapsed time of the weight loops (s) */
+static long kwcall = 0;          /* number of calls to kweng() */
+
+/*
+ *    Weights are returned either in wt (row u holds the weights for grid
+ *    cell iuse[u], one for each available station in station order) or,
+ *    if wt is NULL, in wrow (row l holds the weights for grid cell l, one
+ *    for each station).  Kriging variances, if var is not NULL, go to
+ *    var[u] or var[l] in the same way.
+ */
+
+void kweng(avail, ns, wt, wrow, var)
+int *avail;                      /* station availability flags (NULL = all) */
+int ns;                          /* number of available stations */
+float *wt;                       /* weights for used grid cells (ngriduse x ns) */
+float **wrow;                    /* weights by grid cell (ngrid x nsta) */
+float *var;                      /* kriging variances (ngriduse or ngrid) */
+{
+	double *af;                   /* LU decomposition of station matrix
+	                                 (row i starts at af[i*nsp1]) */
+	double *ap;                   /* factors from symmetric solver (packed,
+	                                 or full with USE_LAPACK) */
+	double apc;                   /* shift from ldlfact() */
+	double aps;                   /* 1'*inv(M)*1 from ldlfact() */
+	double *apu;                  /* inv(M)*1 from ldlfact() */
+	double *b;                    /* right-hand sides for block of cells */
+	double *bl;                   /* LU solutions for check of symmetric
+	                                 solver */
+	int *cl;                      /* grid cells of block with negative
+	                                 weights */
+	float d;                      /* +/- 1 from ludcmp() (not used) */
+	int *done;                    /* flags for cells done by kbatch() */
+	double *g;                    /* distances for block of cells */
+	double *gi;                   /* inverse of station distance matrix */
+	double gs;                    /* 1'*G*1 */
+	double *gu;                   /* G*1 */
+	int c, i, m, u, u1;           /* loop indexes */
+	int *indx;                    /* row permutation from pivoting */
+	int *ista;                    /* indexes of available stations */
+	struct kwork *kw;             /* scratch space of calling thread (for
+	                                 the warm start of krige()) */
+	int mode;                     /* weight engine actually used */
+	int ludcmp();                 /* lu decomposition function */
+	void lubksbm();               /* lu backsubstitution, many r.h.s. */
+	void dmatmul();               /* matrix product */
+	int nb;                       /* number of cells in block */
+	int neg;                      /* flag for negative weight */
+	int nneg;                     /* number of cells of block with
+	                                 negative weights */
+	int nsp1;                     /* ns plus 1 */
+	int sym;                      /* 1 = station matrix factored by
+	                                 symmetric solver */
+	double *vv;                   /* scratch space for ludcmp() */
+	int *pos;                     /* position of each cell of block in cl
+	                                 (-1 = no negative weights) */
+	float *row;                   /* output weights for one cell */
+	double t0;                    /* start time of a block */
+	double tw;                    /* start time of the weight loop */
+	int tn;                       /* number of the calling thread */
+	double *wb;                   /* weights for block of cells from
+	                                 kbatch() */
+	double *wk;                   /* weights for one cell from krige() */
+
+	ista = ivector(nsta);
+	m = 0;
+	for (i = 0; i < nsta; i++)
+		if (avail == NULL || avail[i] == 1)
+			ista[m++] = i;
+
+	/* Factor the station matrix once for all grid cells */
+
+	mode = iweng;
+	if ((N > 0 && N < ns) || srad > 0 || isolv == 4)
+		mode = 1;
+	nsp1 = ns + 1;
+	af = NULL;
+	indx = ivector(nsp1);
+	vv = dvector(nsp1);
+	gi = gu = NULL;
+	gs = 0;
+	ap = apu = NULL;
+	sym = 0;
+	if (mode == 2 && isolv != 1) {
+		apu = dvector(ns);
+#ifdef USE_LAPACK
+		ap = dvector(ns * ns);
+		for (i = 0; i < ns; i++)
+			for (m = 0; m < ns; m++)
+				ap[i * ns + m] = ad[ista[i]][ista[m]];
+		if (chlfact(ap, ns, apu, &aps, &apc) == 0)
+			sym = 1;
+#else
+		ap = dvector(ns * (ns + 1) / 2);
+		for (i = 0; i < ns; i++)
+			for (m = 0; m <= i; m++)
+				ap[i * (i + 1) / 2 + m] = ad[ista[i]][ista[m]];
+		if (ldlfact(ap, ns, apu, &aps, &apc) == 0)
+			sym = 1;
+#endif
+	}
+	if (mode == 2 && (sym == 0 || isolv == 3)) {
+		af = dvector(nsp1 * nsp1);
+		for (i = 0; i < ns; i++) {
+			for (m = 0; m < ns; m++)
+				af[i * nsp1 + m] = ad[ista[i]][ista[m]];
+			af[i * nsp1 + ns] = af[ns * nsp1 + i] = 1;
+		}
+		af[ns * nsp1 + ns] = 0;
+		if (ludcmp(af, nsp1, nsp1, indx, &d, vv) != 0) {
+			free(af);
+			af = NULL;
+			if (sym == 0)
+				mode = 1;
+		}
+	}
+
+	/* Or compute the inverse of the station distance matrix */
+
+	else if (mode == 3) {
+		af = dvector(ns * ns);
+		for (i = 0; i < ns; i++)
+			for (m = 0; m < ns; m++)
+				af[i * ns + m] = ad[ista[i]][ista[m]];
+		if (ludcmp(af, ns, ns, indx, &d, vv) != 0)
+			mode = 1;
+		else {
+			gi = dvector(ns * ns);
+			gu = dvector(ns);
+			for (i = 0; i < ns * ns; i++)
+				gi[i] = 0;
+			for (i = 0; i < ns; i++)
+				gi[i * ns + i] = 1;
+			lubksbm(af, ns, ns, indx, gi, ns);
+			for (i = 0; i < ns; i++) {
+				gu[i] = 0;
+				for (m = 0; m < ns; m++)
+					gu[i] += gi[i * ns + m];
+				gs += gu[i];
+			}
+		}
+	}
+
+	/* Statistics of the threads */
+
+	if (kwbusy == NULL) {
+		kwnt = omp_get_max_threads();
+		kwbusy = dvector(kwnt);
+		kwcell = dvector(kwnt);
+		for (i = 0; i < kwnt; i++)
+			kwbusy[i] = kwcell[i] = 0;
+	}
+	kwcall++;
+	tw = omp_get_wtime();
+
+	/* (With a singular station matrix, krige() reports the problem) */
+
+#pragma omp parallel private(b, bl, c, cl, done, g, i, kw, m, nb, neg, nneg, pos, row, t0, tn, u, u1, wb, wk)
+	{
+		tn = omp_get_thread_num();
+		kw = kwork_get(nsta);
+		wk = dvector(nsta);
+		b = (mode != 1) ? dvector(nsp1 * KBLK) : NULL;
+		bl = (sym == 1 && af != NULL) ? dvector(nsp1 * KBLK) : NULL;
+		g = (mode == 3) ? dvector(ns * KBLK) : NULL;
+		wb = (isolv == 2 && iwarm == 0) ? dvector(nsta * KBLK) : NULL;
+		done = (wb != NULL) ? ivector(KBLK) : NULL;
+		cl = ivector(KBLK);
+		pos = ivector(KBLK);
+
+#pragma omp for schedule(dynamic)
+		for (u1 = 0; u1 < ngriduse; u1 += KBLK) {
+			t0 = omp_get_wtime();
+			nb = ngriduse - u1;
+			if (nb > KBLK)
+				nb = KBLK;
+			kw->nfin = 0;
+
+			/* Solve all cells in the block with the station factorization */
+
+			if (mode == 2) {
+				for (c = 0; c < nb; c++)
+					dist_grid_row(iuse[u1 + c], ista, ns, b + c, nb);
+				for (c = 0; c < nb; c++)
+					b[ns * nb + c] = 1;
+				if (sym == 1) {
+
+					/* (kriging-solver = 3: check against LU) */
+
+					if (bl != NULL) {
+						for (i = 0; i < nsp1 * nb; i++)
+							bl[i] = b[i];
+						lubksbm(af, nsp1, nsp1, indx, bl, nb);
+					}
+#ifdef USE_LAPACK
+					chlsolv(ap, ns, apu, aps, apc, b, nb);
+#else
+					ldlsolv(ap, ns, apu, aps, apc, b, nb);
+#endif
+					if (bl != NULL)
+						ldlcheck(b, bl, ns * nb, nb);
+				}
+				else
+					lubksbm(af, nsp1, nsp1, indx, b, nb);
+			}
+
+			/* Or from the inverse: v = G*d (by dmatmul()), then the
+			   Lagrange correction (the sum 1'*v goes to row ns of b) */
+
+			else if (mode == 3) {
+				for (c = 0; c < nb; c++)
+					dist_grid_row(iuse[u1 + c], ista, ns, g + c, nb);
+				dmatmul(ns, nb, ns, gi, g, b);
+				for (c = 0; c < nb; c++)
+					b[ns * nb + c] = 0;
+				for (i = 0; i < ns; i++)
+					for (c = 0; c < nb; c++)
+						b[ns * nb + c] += b[i * nb + c];
+				for (c = 0; c < nb; c++)
+					b[ns * nb + c] = (1 - b[ns * nb + c]) / gs;
+				for (i = 0; i < ns; i++)
+					for (c = 0; c < nb; c++)
+						b[i * nb + c] += gu[i] * b[ns * nb + c];
+			}
+
+			/* Cells with negative weights (all cells with
+			   weight-engine = 1) need stations eliminated cell by
+			   cell; kbatch() takes them KLANE cells at a time */
+
+			nneg = 0;
+			for (c = 0; c < nb; c++) {
+				neg = 1;
+				if (mode != 1) {
+					neg = 0;
+					for (i = 0; i < ns; i++)
+						if (b[i * nb + c] < 0.0)
+							neg = 1;
+				}
+				pos[c] = -1;
+				if (neg == 1) {
+					pos[c] = nneg;
+					cl[nneg++] = iuse[u1 + c];
+				}
+			}
+			if (wb != NULL && nneg > 0)
+				kbatch(cl, nneg, nsta, avail, wb, done);
+
+			for (c = 0; c < nb; c++) {
+				u = u1 + c;
+				row = (wt != NULL) ? wt + (size_t) u * ns : wrow[iuse[u]];
+
+				/* No negative weights -- done; otherwise eliminate
+				   stations cell by cell */
+
+				if (pos[c] < 0) {
+					for (i = 0; i < ns; i++)
+						row[i] = (float) b[i * nb + c];
+					kw->nfin = 0;
+				}
+				else if (wb != NULL && done[pos[c]] == 1) {
+					for (i = 0; i < ns; i++)
+						row[i] = (float) wb[(size_t) pos[c] * nsta + ista[i]];
+				}
+				else {
+					krige(iuse[u], nsta, ad, elevations, avail, wk);
+					for (i = 0; i < ns; i++)
+						row[i] = (float) wk[ista[i]];
+				}
+				if (var != NULL)
+					var[(wt != NULL) ? u : iuse[u]] =
+							(float) krige_var(iuse[u], ns, ista, row);
+			}
+			if (tn < kwnt) {
+				kwbusy[tn] += omp_get_wtime() - t0;
+				kwcell[tn] += nb;
+			}
+		}
+		free(wk);
+		if (b != NULL)
+			free(b);
+		if (g != NULL)
+			free(g);
+		if (bl != NULL)
+			free(bl);
+		if (wb != NULL) {
+			free(wb);
+			free(done);
+		}
+		free(cl);
+		free(pos);
+	}
+
+	if (af != NULL)
+		free(af);
+	if (ap != NULL) {
+		free(ap);
+		free(apu);
+	}
+	free(indx);
+	free(vv);
+	if (gi != NULL) {
+		free(gi);
+		free(gu);
+	}
+	free(ista);
+	kwwall += omp_get_wtime() - tw;
+}
+
+/*
+ *    Write the time spent by each thread on weight calculation to the
+ *    screen
+ */
+
+void kweng_report()
+{
+	double busy;                  /* total time of all threads */
+	int i;                        /* loop index */
+	double tmax;                  /* longest time of a thread */
+
+	if (kwcall == 0)
+		return;
+	busy = tmax = 0;
+	for (i = 0; i < kwnt; i++) {
+		busy += kwbusy[i];
+		if (kwbusy[i] > tmax)
+			tmax = kwbusy[i];
+	}
+	printf("\nKriging weight calculation (%ld weight sets, %d threads):\n",
+			kwcall, kwnt);
+	printf("   Elapsed time %.2f s,  busy time %.2f s\n", kwwall, busy);
+	for (i = 0; i < kwnt; i++)
+		printf("   Thread %3d:  busy %9.2f s,  grid cells %12.0f\n", i,
+				kwbusy[i], kwcell[i]);
+	if (busy > 0)
+		printf("   Longest / mean busy time %.3f\n", tmax * kwnt / busy);
+}
@@ -0,0 +1,99 @@
+/*
+ *    kwork.c
+ *
+ *    Scratch space for krige()
+ *
+ *    krige() runs for every grid cell whose weights need stations
+ *    eliminated, inside the parallel loops of the weight engine.  Instead
+ *    of allocating its work arrays on every call, each thread allocates
+ *    one workspace the first time it needs it and keeps it for the rest
+ *    of the run.  The workspace is a single block of memory aligned to
+ *    64 bytes; the kriging matrix is stored row by row with the row
+ *    length padded so that every row starts on a 64-byte boundary.
+ *    The workspace also holds the interleaved matrices of kbatch(),
+ *    which solves the systems of KLANE grid cells together.
+ */
+
+#include <malloc/malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "dk_m.h"
+#include "dk_x.h"
+
+#define KWALIGN 64                  /* alignment of workspace (bytes) */
+#define KWROUND(nb) (((nb) + KWALIGN - 1) / KWALIGN * KWALIGN)
+
+static struct kwork kwspace;        /* workspace of this thread */
+static struct kwork *kw = NULL;     /* pointer to workspace (NULL until
+                                       allocated) */
+static char *kwblock = NULL;        /* memory block holding workspace */
+#pragma omp threadprivate(kwspace, kw, kwblock)
+
+/*
+ *    Return the workspace of the calling thread, sized for at least n
+ *    stations
+ */
+
+struct kwork *kwork_get(n)
+int n;                           /* number of stations */
+{
+   size_t na, nd, ni, nf;        /* sizes of parts of block (bytes) */
+   size_t nbp, nbv, nbi;         /* sizes of parts for kbatch() (bytes) */
+   char *p;                      /* pointer into block */
+
+   if (kw != NULL && kw->nmax >= n)
+      return(kw);
+   if (kwblock != NULL)
+      free(kwblock);
+
+   /* Row length of matrix: n+1 columns plus the right-hand side, padded
+      to a multiple of the alignment */
+
+   kwspace.nmax = n;
+   kwspace.nfin = 0;
+   kwspace.lda = KWROUND((n + 2) * sizeof(double)) / sizeof(double);
+   na = KWROUND((size_t) (n + 1) * kwspace.lda * sizeof(double));
+   nd = KWROUND((n + 1) * sizeof(double));
+   ni = KWROUND((n + 1) * sizeof(int));
+   nf = KWROUND(n * sizeof(float));
+   nbp = KWROUND((size_t) KBMAX * (KBMAX + 1) / 2 * KLANE * sizeof(double));
+   nbv = KWROUND(KBMAX * KLANE * sizeof(double));
+   nbi = KWROUND((size_t) n * KLANE * sizeof(int));
+   if (posix_memalign((void **) &kwblock, KWALIGN,
+                      5 * na + 9 * nd + 7 * ni + 2 * nf + 2 * nbp + 2 * nbv + nbi)
+                      != 0) {
+      printf("\n\nAllocation failure in kwork_get().\n");
+      exit(0);
+   }
+
+   p = kwblock;
+   kwspace.a = (double *) p;       p += na;
+   kwspace.z = (double *) p;       p += na;
+   kwspace.c = (double *) p;       p += na;
+   kwspace.p = (double *) p;       p += na;
+   kwspace.pf = (float *) p;       p += na;
+   kwspace.wcalc = (double *) p;   p += nd;
+   kwspace.vv = (double *) p;      p += nd;
+   kwspace.x0 = (double *) p;      p += nd;
+   kwspace.y = (double *) p;       p += nd;
+   kwspace.cvv = (double *) p;     p += nd;
+   kwspace.u = (double *) p;       p += nd;
+   kwspace.rw = (double *) p;      p += 3 * nd;
+   kwspace.indx = (int *) p;       p += ni;
+   kwspace.idx = (int *) p;        p += ni;
+   kwspace.cindx = (int *) p;      p += ni;
+   kwspace.rem = (int *) p;        p += ni;
+   kwspace.act = (int *) p;        p += ni;
+   kwspace.cand = (int *) p;       p += ni;
+   kwspace.fin = (int *) p;        p += ni;
+   kwspace.dist = (float *) p;     p += nf;
+   kwspace.dg = (float *) p;       p += nf;
+   kwspace.bp = (double *) p;      p += nbp;
+   kwspace.bg = (double *) p;      p += nbp;
+   kwspace.bu = (double *) p;      p += nbv;
+   kwspace.bv = (double *) p;      p += nbv;
+   kwspace.bidx = (int *) p;
+   kw = &kwspace;
+   return(kw);
+}
@@ -0,0 +1,190 @@
+/*
+ *    kwstore.c
+ *
+ *    Cache of kriging weights for all stations kept on disk between runs
+ *
+ *    When weight-cache-dir is given, the weights for all stations (wall)
+ *    are stored in a binary file in that directory after they are
+ *    calculated, and read back instead of calculated on later runs with
+ *    the same inputs.  The file name holds a 64-bit FNV-1a hash of
+ *    everything the weights depend on: the station coordinates and
+ *    elevations, the grid header and the coordinates, elevations, and
+ *    use flags of the grid cells, and the settings for the stations used
+ *    at each grid cell and for how the weights are solved.  A run with
+ *    any of these changed looks for a different file, and so calculates
+ *    its weights again.  The hash and sizes are also stored in the file
+ *    and checked when it is read.  With kriging-variance, the kriging
+ *    variances of the grid cells (wvar) follow the weights.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dk_x.h"
+
+#define KWSVER 2                 /* file version (part of the hash) */
+
+static char kwspath[301];        /* name of weight file */
+
+/*
+ *    Add n bytes at p to FNV-1a hash h
+ */
+
+static unsigned long long kwstore_mix(h, p, n)
+unsigned long long h;            /* hash so far */
+void *p;                         /* bytes to add */
+int n;                           /* number of bytes */
+{
+	unsigned char *c;             /* byte pointer */
+	int i;                        /* loop index */
+
+	c = (unsigned char *) p;
+	for (i = 0; i < n; i++) {
+		h ^= c[i];
+		h *= 1099511628211ULL;
+	}
+	return(h);
+}
+
+/*
+ *    Hash of the inputs of the weights, and the name of the weight file
+ */
+
+static unsigned long long kwstore_hash()
+{
+	unsigned long long h;         /* hash */
+	int i;                        /* loop index */
+	int n;                        /* length of directory name */
+	int v;                        /* file version */
+
+	h = 14695981039346656037ULL;
+	v = KWSVER;
+	h = kwstore_mix(h, &v, sizeof(v));
+	h = kwstore_mix(h, &nsta, sizeof(nsta));
+	for (i = 0; i < nsta; i++) {
+		h = kwstore_mix(h, &sta[i].north, sizeof(sta[i].north));
+		h = kwstore_mix(h, &sta[i].east, sizeof(sta[i].east));
+		h = kwstore_mix(h, &sta[i].elev, sizeof(sta[i].elev));
+	}
+	h = kwstore_mix(h, &icoord, sizeof(icoord));
+	if (icoord == 3) {
+		h = kwstore_mix(h, &grass.north, sizeof(grass.north));
+		h = kwstore_mix(h, &grass.south, sizeof(grass.south));
+		h = kwstore_mix(h, &grass.east, sizeof(grass.east));
+		h = kwstore_mix(h, &grass.west, sizeof(grass.west));
+		h = kwstore_mix(h, &grass.rows, sizeof(grass.rows));
+		h = kwstore_mix(h, &grass.cols, sizeof(grass.cols));
+	}
+	else if (icoord == 4) {
+		h = kwstore_mix(h, &arc.cols, sizeof(arc.cols));
+		h = kwstore_mix(h, &arc.rows, sizeof(arc.rows));
+		h = kwstore_mix(h, &arc.xll, sizeof(arc.xll));
+		h = kwstore_mix(h, &arc.yll, sizeof(arc.yll));
+		h = kwstore_mix(h, &arc.cell, sizeof(arc.cell));
+	}
+	h = kwstore_mix(h, &ngrid, sizeof(ngrid));
+	for (i = 0; i < ngrid; i++) {
+		h = kwstore_mix(h, &grid[i].north, sizeof(grid[i].north));
+		h = kwstore_mix(h, &grid[i].east, sizeof(grid[i].east));
+		h = kwstore_mix(h, &grid[i].elev, sizeof(grid[i].elev));
+		h = kwstore_mix(h, &grid[i].use, sizeof(grid[i].use));
+	}
+	h = kwstore_mix(h, &iwt, sizeof(iwt));
+	h = kwstore_mix(h, &N, sizeof(N));
+	h = kwstore_mix(h, &srad, sizeof(srad));
+	h = kwstore_mix(h, &sradmin, sizeof(sradmin));
+	h = kwstore_mix(h, &sradmax, sizeof(sradmax));
+	h = kwstore_mix(h, &iweng, sizeof(iweng));
+	h = kwstore_mix(h, &isolv, sizeof(isolv));
+	h = kwstore_mix(h, &iwarm, sizeof(iwarm));
+	h = kwstore_mix(h, &ivar, sizeof(ivar));
+
+	strcpy(kwspath, kwdir);
+	n = strlen(kwspath);
+	if (n > 0 && kwspath[n-1] != '/' && kwspath[n-1] != '\\')
+		strcat(kwspath, "/");
+	sprintf(kwspath + strlen(kwspath), "dkw_%016llx.bin", h);
+	return(h);
+}
+
+/*
+ *    Read the weights from the weight file, if there is one for the
+ *    current inputs.  Returns 1 if the weights were read, 0 if not.
+ */
+
+int kwstore_load()
+{
+	FILE *fp;                     /* weight file */
+	unsigned long long h, hf;     /* hash of inputs, and from file */
+	char magic[4];                /* file identifier */
+	int n[3];                     /* nsta, ngriduse, and variance flag
+	                                 from file */
+	int ok;                       /* 1 = file read completely */
+	int u;                        /* loop index */
+
+	h = kwstore_hash();
+	if ((fp = fopen(kwspath, "rb")) == NULL)
+		return(0);
+	ok = (fread(magic, 1, 4, fp) == 4 && memcmp(magic, "DKW1", 4) == 0 &&
+			fread(&hf, sizeof(hf), 1, fp) == 1 && hf == h &&
+			fread(n, sizeof(int), 3, fp) == 3 && n[0] == nsta &&
+			n[1] == ngriduse && n[2] == ivar);
+	for (u = 0; ok == 1 && u < ngriduse; u++)
+		ok = (fread(wall[iuse[u]], sizeof(float), nsta, fp) == (size_t) nsta);
+	for (u = 0; ok == 1 && ivar == 1 && u < ngriduse; u++)
+		ok = (fread(&wvar[iuse[u]], sizeof(float), 1, fp) == 1);
+	fclose(fp);
+	if (ok == 0)
+		printf("\nWARNING - kriging weight file %s is not usable\n", kwspath);
+	else
+		printf("\nKriging weights read from %s\n", kwspath);
+	return(ok);
+}
+
+/*
+ *    Write the weights to the weight file for the current inputs
+ */
+
+void kwstore_save()
+{
+	FILE *fp;                     /* weight file */
+	unsigned long long h;         /* hash of inputs */
+	int n[3];                     /* nsta, ngriduse, and variance flag */
+	int ok;                       /* 1 = file written completely */
+	char tmp[311];                /* name of file while it is written */
+	int u;                        /* loop index */
+
+	h = kwstore_hash();
+	sprintf(tmp, "%s.tmp", kwspath);
+	if ((fp = fopen(tmp, "wb")) == NULL) {
+		printf("\nWARNING - cannot write kriging weight file %s\n", tmp);
+		return;
+	}
+	n[0] = nsta;
+	n[1] = ngriduse;
+	n[2] = ivar;
+	ok = (fwrite("DKW1", 1, 4, fp) == 4 && fwrite(&h, sizeof(h), 1, fp) == 1 &&
+			fwrite(n, sizeof(int), 3, fp) == 3);
+	for (u = 0; ok == 1 && u < ngriduse; u++)
+		ok = (fwrite(wall[iuse[u]], sizeof(float), nsta, fp) == (size_t) nsta);
+	for (u = 0; ok == 1 && ivar == 1 && u < ngriduse; u++)
+		ok = (fwrite(&wvar[iuse[u]], sizeof(float), 1, fp) == 1);
+	if (fclose(fp) != 0)
+		ok = 0;
+
+	/* Rename only a complete file, so that an interrupted run or another
+	   run reading at the same time never sees part of one (where rename()
+	   cannot replace an existing file, that file is removed first) */
+
+	if (ok == 1 && rename(tmp, kwspath) != 0) {
+		remove(kwspath);
+		ok = (rename(tmp, kwspath) == 0);
+	}
+	if (ok == 0) {
+		remove(tmp);
+		printf("\nWARNING - cannot write kriging weight file %s\n", kwspath);
+	}
+	else
+		printf("\nKriging weights written to %s\n", kwspath);
+}
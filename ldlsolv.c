@@ -0,0 +1,581 @@
+/*
+ *    ldlsolv.c
+ *
+ *    Solve the ordinary kriging system
+ *
+ *       [ G   1 ] [ w ]   [ r ]
+ *       [ 1'  0 ] [ m ] = [ t ]
+ *
+ *    using the symmetry of the matrix G of distances among the stations.
+ *    For a linear variogram, M = c*11' - G is positive definite when the
+ *    shift c is about the largest distance, so M is factored as L*D*L'
+ *    (no pivoting) on its packed lower triangle, and the Lagrange row is
+ *    handled through its Schur complement:
+ *
+ *       u = inv(M)*1,   s = 1'*u,   v = inv(M)*r,
+ *       m' = (t + 1'*v) / s,   w = m'*u - v,   m = m' - c*t
+ *
+ *    (Subtracting c*11' from G does not change the weights, because
+ *    1'*w = t, only the Lagrange multiplier.)  This takes about half of
+ *    the operations and half of the memory of LU decomposition of the
+ *    bordered matrix.  If a pivot of D is not positive, the
+ *    factorization is reported as failed and the caller falls back to
+ *    LU decomposition.
+ *
+ *    The packed triangle holds element (i,j), j <= i, at ap[i*(i+1)/2+j].
+ *    After factoring, the diagonal holds D and the rest L.
+ *
+ *    With kriging-solver = 4 (mixed precision), M is factored in single
+ *    precision (ldlfactf()), which takes half the memory traffic and
+ *    fits twice as many elements in a vector register, and each
+ *    solution is brought back to double precision by NREFINE steps of
+ *    iterative refinement:
+ *
+ *       r = b - M*x (double),   solve M*e = r (single),   x = x + e
+ *
+ *    M itself is kept in double precision for the residuals.  The
+ *    relative residual of the kriging equations is recorded for each
+ *    grid cell (kresid) and written to a file of its own (for
+ *    precipitation prc_resid.txt), with a summary in the main output
+ *    file.
+ *
+ *    When compiled with USE_LAPACK (see makefile), the weight engine
+ *    (kweng.c), which solves the right-hand sides of all grid cells with
+ *    one factorization, factors M as L*L' by dpotrf of a system LAPACK
+ *    on the full matrix and solves by dtrsm (chlfact(), chlsolv()).  The
+ *    packed factors of ldlfact() are still used for the systems of single
+ *    grid cells, since the factorization cache and the batched solver
+ *    (kbatch.c) share them.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "dk_m.h"
+#include "dk_x.h"
+
+#define PK(i, j) ap[(size_t) (i) * ((i) + 1) / 2 + (j)]
+
+void ldlbksbm();                 /* forward- and backsubstitution */
+void ldlsolvf();                 /* mixed-precision solution with M */
+
+#ifdef USE_LAPACK
+void dpotrf_();                  /* LAPACK Cholesky factorization */
+void dtrsm_();                   /* BLAS triangular solve, many r.h.s. */
+#endif
+
+static long ldlnchk = 0;         /* number of solutions checked against LU */
+static long ldlnfail = 0;        /* number of failed factorizations */
+static double ldlmaxd = 0;       /* largest difference from LU solution */
+
+/*
+ *    Factor M = c*11' - G in place; G is given in ap.  Returns 0 for
+ *    success, 1 if M is not positive definite.
+ */
+
+int ldlfact(ap, n, u, s, c)
+double *ap;                      /* packed G, replaced by factors of M */
+int n;                           /* number of stations */
+double *u;                       /* inv(M)*1 */
+double *s;                       /* 1'*inv(M)*1 */
+double *c;                       /* shift */
+{
+	int i, j, k;                  /* loop indexes */
+	double *ri, *rj;              /* rows i and j of packed triangle */
+	double sum;                   /* summing variable */
+	double tol;                   /* smallest acceptable pivot */
+
+	*c = 0;
+	for (i = 0; i < n * (n + 1) / 2; i++)
+		if (ap[i] > *c)
+			*c = ap[i];
+	if (*c <= 0)
+		*c = 1;
+	for (i = 0; i < n * (n + 1) / 2; i++)
+		ap[i] = *c - ap[i];
+	tol = 1.0e-12 * *c;
+
+	/* Row i: first L(i,j)*D(j) for j < i, then L(i,j) and D(i) */
+
+	for (i = 0; i < n; i++) {
+		ri = &PK(i, 0);
+		for (j = 0; j < i; j++) {
+			rj = &PK(j, 0);
+			sum = ri[j];
+			for (k = 0; k < j; k++)
+				sum -= ri[k] * rj[k];
+			ri[j] = sum;
+		}
+		sum = ri[i];
+		for (j = 0; j < i; j++) {
+			rj = &PK(j, 0);
+			ri[j] /= rj[j];
+			sum -= ri[j] * ri[j] * rj[j];
+		}
+		if (sum <= tol) {
+#pragma omp atomic
+			ldlnfail++;
+			return(1);
+		}
+		ri[i] = sum;
+	}
+
+	/* Solution for the Lagrange column */
+
+	for (i = 0; i < n; i++)
+		u[i] = 1;
+	ldlbksbm(ap, n, u, 1);
+	*s = 0;
+	for (i = 0; i < n; i++)
+		*s += u[i];
+	return(0);
+}
+
+/*
+ *    Solve M*x = b for the n X nb matrix b (row i starts at b[i*nb]),
+ *    which is overwritten with the solutions
+ */
+
+void ldlbksbm(ap, n, b, nb)
+double *ap;                      /* factors of M from ldlfact() */
+int n;                           /* number of stations */
+double *b;                       /* right-hand sides / solutions */
+int nb;                          /* number of right-hand sides */
+{
+	double aij;                   /* matrix element */
+	double *bi, *bj;              /* rows of b */
+	int c, i, j;                  /* looping indexes */
+
+	/* Forward substitution with L */
+
+	for (i = 0; i < n; i++) {
+		bi = b + (size_t) i * nb;
+		for (j = 0; j < i; j++) {
+			aij = PK(i, j);
+			bj = b + (size_t) j * nb;
+			for (c = 0; c < nb; c++)
+				bi[c] -= aij * bj[c];
+		}
+	}
+
+	/* Divide by D, backsubstitution with L' */
+
+	for (i = n-1; i >= 0; i--) {
+		bi = b + (size_t) i * nb;
+		aij = 1.0 / PK(i, i);
+		for (c = 0; c < nb; c++)
+			bi[c] *= aij;
+		for (j = i+1; j < n; j++) {
+			aij = PK(j, i);
+			bj = b + (size_t) j * nb;
+			for (c = 0; c < nb; c++)
+				bi[c] -= aij * bj[c];
+		}
+	}
+}
+
+/*
+ *    Finish the solution of the kriging system from inv(M)*r in rows
+ *    0..n-1 of the (n+1) X nb matrix b and t in row n
+ */
+
+static void ldlbord(n, u, s, c, b, nb)
+int n;                           /* number of stations */
+double *u;                       /* inv(M)*1 */
+double s;                        /* 1'*inv(M)*1 */
+double c;                        /* shift */
+double *b;                       /* right-hand sides / solutions */
+int nb;                          /* number of right-hand sides */
+{
+	double *bn;                   /* row n of b */
+	int i, k;                     /* looping indexes */
+	double *bi;                   /* row i of b */
+
+	bn = b + (size_t) n * nb;
+	for (i = 0; i < n; i++) {
+		bi = b + (size_t) i * nb;
+		for (k = 0; k < nb; k++)
+			bn[k] += bi[k];
+	}
+	for (k = 0; k < nb; k++)
+		bn[k] /= s;
+	for (i = 0; i < n; i++) {
+		bi = b + (size_t) i * nb;
+		for (k = 0; k < nb; k++)
+			bi[k] = bn[k] * u[i] - bi[k];
+	}
+
+	/* bn now holds m' = m + c*t, and t = 1'*w */
+
+	for (k = 0; k < nb; k++) {
+		for (i = 0; i < n; i++)
+			bn[k] -= c * b[(size_t) i * nb + k];
+	}
+}
+
+/*
+ *    Solve the kriging system for the (n+1) X nb matrix b of right-hand
+ *    sides (rows 0..n-1 hold r, row n holds t), which is overwritten
+ *    with the solutions (weights in rows 0..n-1, Lagrange multipliers in
+ *    row n)
+ */
+
+void ldlsolv(ap, n, u, s, c, b, nb)
+double *ap;                      /* factors of M from ldlfact() */
+int n;                           /* number of stations */
+double *u;                       /* inv(M)*1 */
+double s;                        /* 1'*inv(M)*1 */
+double c;                        /* shift */
+double *b;                       /* right-hand sides / solutions */
+int nb;                          /* number of right-hand sides */
+{
+	ldlbksbm(ap, n, b, nb);
+	ldlbord(n, u, s, c, b, nb);
+}
+
+#ifdef USE_LAPACK
+
+/*
+ *    Solve M*x = b for the n X nb matrix b (row i starts at b[i*nb]) with
+ *    the factor L from chlfact().  The rows of b are the columns of b',
+ *    so x' = b'*inv(L')*inv(L) is two triangular solves from the right.
+ */
+
+static void chlbksbm(a, n, b, nb)
+double *a;                       /* factor of M from chlfact() */
+int n;                           /* number of stations */
+double *b;                       /* right-hand sides / solutions */
+int nb;                          /* number of right-hand sides */
+{
+	double one = 1.0;             /* scale factor for dtrsm */
+
+	dtrsm_("R", "L", "T", "N", &nb, &n, &one, a, &n, b, &nb);
+	dtrsm_("R", "L", "N", "N", &nb, &n, &one, a, &n, b, &nb);
+}
+
+/*
+ *    Factor M = c*11' - G in place as L*L'; G is given in full in a
+ *    (n X n, symmetric, so that row and column order are the same).
+ *    Returns 0 for success, 1 if M is not positive definite.
+ */
+
+int chlfact(a, n, u, s, c)
+double *a;                       /* G, replaced by factor of M */
+int n;                           /* number of stations */
+double *u;                       /* inv(M)*1 */
+double *s;                       /* 1'*inv(M)*1 */
+double *c;                       /* shift */
+{
+	int i;                        /* loop index */
+	int info;                     /* return value from dpotrf */
+
+	*c = 0;
+	for (i = 0; i < n * n; i++)
+		if (a[i] > *c)
+			*c = a[i];
+	if (*c <= 0)
+		*c = 1;
+	for (i = 0; i < n * n; i++)
+		a[i] = *c - a[i];
+
+	/* Same smallest acceptable pivot as ldlfact() (D = diagonal of L
+	   squared) */
+
+	dpotrf_("L", &n, a, &n, &info);
+	for (i = 0; i < n && info == 0; i++)
+		if (a[(size_t) i * n + i] * a[(size_t) i * n + i] <= 1.0e-12 * *c)
+			info = i + 1;
+	if (info != 0) {
+#pragma omp atomic
+		ldlnfail++;
+		return(1);
+	}
+
+	for (i = 0; i < n; i++)
+		u[i] = 1;
+	chlbksbm(a, n, u, 1);
+	*s = 0;
+	for (i = 0; i < n; i++)
+		*s += u[i];
+	return(0);
+}
+
+/*
+ *    Solve the kriging system for the (n+1) X nb matrix b of right-hand
+ *    sides with the factor from chlfact(), as ldlsolv() does with those
+ *    from ldlfact()
+ */
+
+void chlsolv(a, n, u, s, c, b, nb)
+double *a;                       /* factor of M from chlfact() */
+int n;                           /* number of stations */
+double *u;                       /* inv(M)*1 */
+double s;                        /* 1'*inv(M)*1 */
+double c;                        /* shift */
+double *b;                       /* right-hand sides / solutions */
+int nb;                          /* number of right-hand sides */
+{
+	chlbksbm(a, n, b, nb);
+	ldlbord(n, u, s, c, b, nb);
+}
+
+#endif
+
+/*
+ *    Factor M = c*11' - G in single precision (kriging-solver = 4).  G is
+ *    given in ap, which is replaced by M (in double precision, for the
+ *    residuals of iterative refinement); the factors go to af.  Returns
+ *    0 for success, 1 if M is not positive definite.
+ */
+
+int ldlfactf(ap, af, n, u, s, c, wk)
+double *ap;                      /* packed G, replaced by M */
+float *af;                       /* packed factors of M */
+int n;                           /* number of stations */
+double *u;                       /* inv(M)*1 */
+double *s;                       /* 1'*inv(M)*1 */
+double *c;                       /* shift */
+double *wk;                      /* scratch space (3*n) */
+{
+	int i, j, k;                  /* loop indexes */
+	float *ri, *rj;               /* rows i and j of packed triangle */
+	float sum;                    /* summing variable */
+	float tol;                    /* smallest acceptable pivot */
+
+	*c = 0;
+	for (i = 0; i < n * (n + 1) / 2; i++)
+		if (ap[i] > *c)
+			*c = ap[i];
+	if (*c <= 0)
+		*c = 1;
+	for (i = 0; i < n * (n + 1) / 2; i++) {
+		ap[i] = *c - ap[i];
+		af[i] = (float) ap[i];
+	}
+	tol = (float) (1.0e-6 * *c);
+
+	for (i = 0; i < n; i++) {
+		ri = af + (size_t) i * (i + 1) / 2;
+		for (j = 0; j < i; j++) {
+			rj = af + (size_t) j * (j + 1) / 2;
+			sum = ri[j];
+			for (k = 0; k < j; k++)
+				sum -= ri[k] * rj[k];
+			ri[j] = sum;
+		}
+		sum = ri[i];
+		for (j = 0; j < i; j++) {
+			rj = af + (size_t) j * (j + 1) / 2;
+			ri[j] /= rj[j];
+			sum -= ri[j] * ri[j] * rj[j];
+		}
+		if (sum <= tol) {
+#pragma omp atomic
+			ldlnfail++;
+			return(1);
+		}
+		ri[i] = sum;
+	}
+
+	for (i = 0; i < n; i++)
+		u[i] = 1;
+	ldlsolvf(ap, af, n, u, wk);
+	*s = 0;
+	for (i = 0; i < n; i++)
+		*s += u[i];
+	return(0);
+}
+
+/*
+ *    Solve M*x = b with the single-precision factors from ldlfactf() and
+ *    iterative refinement; b is given in x, which is overwritten with
+ *    the solution
+ */
+
+void ldlsolvf(ap, af, n, x, wk)
+double *ap;                      /* M from ldlfactf() */
+float *af;                       /* factors of M from ldlfactf() */
+int n;                           /* number of stations */
+double *x;                       /* right-hand side / solution */
+double *wk;                      /* scratch space (3*n) */
+{
+	float aij;                    /* matrix element */
+	double *b;                    /* right-hand side */
+	int i, j, k;                  /* loop indexes */
+	double *r;                    /* residual */
+	float *xf;                    /* single-precision solution */
+
+	b = wk;
+	r = wk + n;
+	xf = (float *) (wk + 2 * n);
+	for (i = 0; i < n; i++) {
+		b[i] = r[i] = x[i];
+		x[i] = 0;
+	}
+	for (k = 0; k <= NREFINE; k++) {
+
+		/* r = b - M*x (first pass: r = b, x = 0) */
+
+		if (k > 0) {
+			for (i = 0; i < n; i++)
+				r[i] = b[i];
+			for (i = 0; i < n; i++) {
+				for (j = 0; j < i; j++) {
+					r[i] -= PK(i, j) * x[j];
+					r[j] -= PK(i, j) * x[i];
+				}
+				r[i] -= PK(i, i) * x[i];
+			}
+		}
+
+		/* Correction from the single-precision factors */
+
+		for (i = 0; i < n; i++)
+			xf[i] = (float) r[i];
+		for (i = 0; i < n; i++)
+			for (j = 0; j < i; j++)
+				xf[i] -= af[(size_t) i * (i + 1) / 2 + j] * xf[j];
+		for (i = n-1; i >= 0; i--) {
+			xf[i] /= af[(size_t) i * (i + 1) / 2 + i];
+			for (j = i+1; j < n; j++) {
+				aij = af[(size_t) j * (j + 1) / 2 + i];
+				xf[i] -= aij * xf[j];
+			}
+		}
+		for (i = 0; i < n; i++)
+			x[i] += xf[i];
+	}
+}
+
+/*
+ *    Solve the kriging system for one right-hand side (rows 0..n-1 of b
+ *    hold r, row n holds t) with the factors from ldlfactf(), as
+ *    ldlsolv() does with those from ldlfact()
+ */
+
+void ldlsolvm(ap, af, n, u, s, c, b, wk)
+double *ap;                      /* M from ldlfactf() */
+float *af;                       /* factors of M from ldlfactf() */
+int n;                           /* number of stations */
+double *u;                       /* inv(M)*1 */
+double s;                        /* 1'*inv(M)*1 */
+double c;                        /* shift */
+double *b;                       /* right-hand side / solution */
+double *wk;                      /* scratch space (3*n) */
+{
+	int i;                        /* loop index */
+
+	ldlsolvf(ap, af, n, b, wk);
+	for (i = 0; i < n; i++)
+		b[n] += b[i];
+	b[n] /= s;
+	for (i = 0; i < n; i++)
+		b[i] = b[n] * u[i] - b[i];
+	for (i = 0; i < n; i++)
+		b[n] -= c * b[i];
+}
+
+/*
+ *    Compare a solution from the symmetric solver with the LU solution
+ *    of the same system (kriging-solver = 3)
+ */
+
+void ldlcheck(x, xlu, n, nsys)
+double *x;                       /* solution from ldlsolv() */
+double *xlu;                     /* solution from LU decomposition */
+int n;                           /* number of values */
+int nsys;                        /* number of systems the values are from */
+{
+	int i;                        /* loop index */
+	double dmax;                  /* largest difference */
+
+	dmax = 0;
+	for (i = 0; i < n; i++) {
+		if (x[i] - xlu[i] > dmax)
+			dmax = x[i] - xlu[i];
+		if (xlu[i] - x[i] > dmax)
+			dmax = xlu[i] - x[i];
+	}
+#pragma omp critical (ldlchk)
+	{
+		ldlnchk += nsys;
+		if (dmax > ldlmaxd)
+			ldlmaxd = dmax;
+	}
+}
+
+/*
+ *    Write the residuals of the mixed-precision solver for each grid
+ *    cell to a file of their own, and in summary to main output file
+ */
+
+void ldlresid_report()
+{
+	FILE *fpres;                  /* residual file pointer */
+	int i;                        /* loop index */
+	int imax;                     /* grid cell with largest residual */
+	int nabove;                   /* number of cells above single precision */
+	int nused;                    /* number of used grid cells */
+	char resfile[25];             /* residual file name */
+	double rsum;                  /* sum of residuals */
+
+	if (type == 1)
+		strcpy(resfile, "prc_");
+	else if (type == 2)
+		strcpy(resfile, "tmp_");
+	else if (type == 3)
+		strcpy(resfile, "swe_");
+	else
+		strcpy(resfile, "dat_");
+	strcat(resfile, "resid.txt");
+	if ((fpres = fopen(resfile, "w")) == NULL)
+		printf("\n\nError opening file %s.\n", resfile);
+	else {
+		fprintf(fpres, "Largest relative residual of the kriging equations, by grid cell:\n");
+		fprintf(fpres, "\nGrid\nPt.:   Residual:\n");
+	}
+
+	fprintf(fpout, "\nMixed-precision kriging solver (%d refinement steps):\n",
+			NREFINE);
+	imax = -1;
+	nabove = nused = 0;
+	rsum = 0;
+	for (i = 0; i < ngrid; i++) {
+		if (grid[i].use == 1) {
+			if (fpres != NULL)
+				fprintf(fpres, "\n%d %10.3e", i+1, kresid[i]);
+			nused++;
+			rsum += kresid[i];
+			if (imax < 0 || kresid[i] > kresid[imax])
+				imax = i;
+			if (kresid[i] > 1.2e-7)
+				nabove++;
+		}
+	}
+	if (fpres != NULL) {
+		fprintf(fpres, "\n");
+		fclose(fpres);
+		fprintf(fpout, "   Residuals by grid cell written to file %s\n", resfile);
+	}
+	if (imax >= 0) {
+		fprintf(fpout, "   Largest residual %.3e (grid cell %d),  mean %.3e\n",
+				kresid[imax], imax+1, rsum / nused);
+		fprintf(fpout, "   Grid cells above single-precision epsilon (1.2e-7) %d\n",
+				nabove);
+	}
+	fprintf(fpout, "   Systems solved by LU (not positive definite after shift) %ld\n",
+			ldlnfail);
+}
+
+/*
+ *    Write results of the check to main output file
+ */
+
+void ldlcheck_report()
+{
+	fprintf(fpout, "\nSymmetric kriging solver checked against LU decomposition:\n");
+	fprintf(fpout, "   Systems compared %ld,  largest difference in weights %.3e\n",
+			ldlnchk, ldlmaxd);
+	fprintf(fpout, "   Systems solved by LU (not positive definite after shift) %ld\n",
+			ldlnfail);
+}
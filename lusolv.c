@@ -10,40 +10,53 @@
  *    Algorithms taken from:
  *    W. H. Press, B. P. Flannery, S. A. Teukolsky, and W. T. Vetterling
  *    (1988).  Numerical Recipes in C.  Cambridge University Press, pp. 43-44.
+ *
+ *    Modification, October 2026:
+ *       Matrices are stored in one contiguous block (row i starts at
+ *       a[i*lda]) instead of as an array of row pointers, and the
+ *       scratch vectors indx and vv are supplied by the caller, so that
+ *       nothing is allocated here
+ *
+ *    Modification, October 2026:
+ *       When compiled with USE_LAPACK (see makefile), ludcmp(), lubksb(),
+ *       and lubksbm() call dgetrf and dtrsm of a system LAPACK/BLAS
+ *       instead (see the end of this file); the routines here remain the
+ *       default
  */
 
 #include <malloc/malloc.h>
 #include <math.h>
 #include <stdio.h>
 
+#define A(i, j) a[(size_t) (i) * lda + (j)]
+
 /* #define TINY 1.0e-20; */
 
-int lusolv(n, a, x)
+int lusolv(n, a, lda, x, indx, vv)
 int n;                          /* number of rows and columns in matrix a */
-double **a;                     /* input matrix */
+double *a;                      /* input matrix (r.h.s. in column n) */
+int lda;                        /* row length of a (at least n+1) */
 double *x;                      /* vector of equation solutions */
+int *indx;                      /* row permutation from pivoting (n) */
+double *vv;                     /* scratch space for ludcmp() (n) */
 {
 	float d;                     /* +/- 1 for even or odd number of
                                    row interchanges */
 	int i;                       /* looping index */
-	int *indx;                   /* row permutation from pivoting */
-	int *ivector();              /* int vector space allocation function */
 	int ludcmp();                /* lu decomposition function */
 	void lubksb();               /* lu backsubstitution function */
-//	void free();
 	int ret;                     /* function return value */
 
-	indx = ivector(n);
-
-	if ((ret = ludcmp(a, n, indx, &d)) != 0)
+	if ((ret = ludcmp(a, n, lda, indx, &d, vv)) != 0)
 		return(1);
-	lubksb(a, n, indx);
+	lubksb(a, n, lda, indx);
 	for (i = 0; i < n; i++)
-		x[i] = a[i][n];
-	free(indx);
+		x[i] = A(i, n);
 	return(0);
 }
 
+#ifndef USE_LAPACK
+
 /*
  *    ludcmp.c
  *
@@ -51,23 +64,22 @@ double *x;                      /* vector of equation solutions */
  *    of a rowwise permutation of itself.
  */
 
-int ludcmp(a, n, indx, d)
-double **a;                     /* input matrix */
+int ludcmp(a, n, lda, indx, d, vv)
+double *a;                      /* input matrix */
 int n;                          /* number of rows and columns in matrix a */
+int lda;                        /* row length of a */
 int *indx;                      /* row permutation from pivoting */
 float *d;                       /* +/- 1 for even or odd number of
                                    row interchanges */
+double *vv;                     /* implicit scaling information for a row */
 {
 	double big;                  /* largest array element */
 	double dum;                  /* dummy variable */
-	double *dvector();           /* double vector space allocation function */
 	int i, j, k;                 /* looping indexes */
 	int imax;                    /* index of largest array element */
 	double sum;                  /* summing variable */
 	double temp;                 /* temporary variable */
-	double *vv;                  /* implicit scaling information for a row */
 
-	vv = dvector(n);
 	*d = 1.0;
 
 	/* Loop over rows to get the implicit scaling information */
@@ -75,7 +87,7 @@ float *d;                       /* +/- 1 for even or odd number of
 	for (i = 0; i < n; i++) {
 		big = 0.0;
 		for (j = 0; j < n; j++)
-			if ((temp = fabs(a[i][j])) > big)
+			if ((temp = fabs(A(i, j))) > big)
 				big = temp;
 
 		/* No nonzero largest element -- singular matrix, no solution */
@@ -92,20 +104,20 @@ float *d;                       /* +/- 1 for even or odd number of
 
 	for (j = 0; j < n; j++) {
 		for (i = 0; i < j; i++) {
-			sum = a[i][j];
+			sum = A(i, j);
 			for (k = 0; k < i; k++)
-				sum -= a[i][k] * a[k][j];
-			a[i][j] = sum;
+				sum -= A(i, k) * A(k, j);
+			A(i, j) = sum;
 		}
 
 		/* Search for largest pivot element */
 
 		big = 0.0;
 		for (i = j; i < n; i++) {
-			sum = a[i][j];
+			sum = A(i, j);
 			for (k = 0; k < j; k++)
-				sum -= a[i][k] * a[k][j];
-			a[i][j] = sum;
+				sum -= A(i, k) * A(k, j);
+			A(i, j) = sum;
 			if ((dum = vv[i] * fabs(sum)) >= big) {
 				big = dum;
 				imax = i;
@@ -116,9 +128,9 @@ float *d;                       /* +/- 1 for even or odd number of
 
 		if (j != imax) {
 			for (k = 0; k < n; k++) {
-				dum = a[imax][k];
-				a[imax][k] = a[j][k];
-				a[j][k] = dum;
+				dum = A(imax, k);
+				A(imax, k) = A(j, k);
+				A(j, k) = dum;
 			}
 			*d = -(*d);
 			vv[imax] = vv[j];
@@ -128,22 +140,21 @@ float *d;                       /* +/- 1 for even or odd number of
 		/* If the pivot element is zero, the matrix is singular (at least
          to the precision of the algorithm) */
 
-		if (a[j][j] == 0.0)
+		if (A(j, j) == 0.0)
 			return(1);
 		/* For some applications on singular matrices, it is desirable
             to substitute TINY for zero; this line is given in the book
             but is not used here:
-         a[j][j] = TINY; */
+         A(j, j) = TINY; */
 
 		/* Divide by pivot element */
 
 		if (j != n-1) {
-			dum = 1.0 / a[j][j];
+			dum = 1.0 / A(j, j);
 			for (i = j+1; i < n; i++)
-				a[i][j] *= dum;
+				A(i, j) *= dum;
 		}
 	}
-	free(vv);
 	return(0);
 }
 
@@ -156,9 +167,10 @@ float *d;                       /* +/- 1 for even or odd number of
  *    matrix a.
  */
 
-void lubksb(a, n, indx)
-double **a;                     /* input matrix */
+void lubksb(a, n, lda, indx)
+double *a;                      /* input matrix */
 int n;                          /* number of rows and columns in matrix a */
+int lda;                        /* row length of a (at least n+1) */
 int *indx;                      /* row permutation from pivoting */
 {
 	int i, j;                    /* looping indexes */
@@ -170,23 +182,174 @@ int *indx;                      /* row permutation from pivoting */
 
 	for (i = 0; i < n; i++) {
 		ip = indx[i];
-		sum = a[ip][n];
-		a[ip][n] = a[i][n];
+		sum = A(ip, n);
+		A(ip, n) = A(i, n);
 		if (ii >= 0) {
 			for (j = ii; j < i; j++)
-				sum -= a[i][j] * a[j][n];
+				sum -= A(i, j) * A(j, n);
 		}
 		else if (sum > 0.0)
 			ii = i;
-		a[i][n] = sum;
+		A(i, n) = sum;
 	}
 
 	/* Backsubstitution */
 
 	for (i = n-1; i >= 0; i--) {
-		sum = a[i][n];
+		sum = A(i, n);
 		for (j = i+1; j < n; j++)
-			sum -= a[i][j] * a[j][n];
-		a[i][n] = sum / a[i][i];
+			sum -= A(i, j) * A(j, n);
+		A(i, n) = sum / A(i, i);
+	}
+}
+
+/*
+ *    lubksbm.c
+ *
+ *    Solves a set of linear equations for many right-hand sides at once
+ *    by forward- and backsubstitution.  The input matrix a is an LU
+ *    decomposition of the original matrix from ludcmp().  The right-hand
+ *    side vectors are the columns of the n X nb matrix b (row i starts at
+ *    b[i*nb]), which is overwritten with the solutions.  Working on all
+ *    columns together keeps the inner loops on contiguous memory.
+ */
+
+void lubksbm(a, n, lda, indx, b, nb)
+double *a;                      /* LU decomposed matrix */
+int n;                          /* number of rows and columns in matrix a */
+int lda;                        /* row length of a */
+int *indx;                      /* row permutation from pivoting */
+double *b;                      /* right-hand sides / solutions */
+int nb;                         /* number of right-hand sides */
+{
+	double aij;                  /* matrix element */
+	double *bi, *bj;             /* rows of b */
+	int c, i, j;                 /* looping indexes */
+	int ip;                      /* index value */
+	double temp;                 /* temporary variable */
+
+	/* Forward substitution */
+
+	for (i = 0; i < n; i++) {
+		ip = indx[i];
+		bi = b + (size_t) i * nb;
+		if (ip != i) {
+			bj = b + (size_t) ip * nb;
+			for (c = 0; c < nb; c++) {
+				temp = bj[c];
+				bj[c] = bi[c];
+				bi[c] = temp;
+			}
+		}
+		for (j = 0; j < i; j++) {
+			aij = A(i, j);
+			bj = b + (size_t) j * nb;
+			for (c = 0; c < nb; c++)
+				bi[c] -= aij * bj[c];
+		}
+	}
+
+	/* Backsubstitution */
+
+	for (i = n-1; i >= 0; i--) {
+		bi = b + (size_t) i * nb;
+		for (j = i+1; j < n; j++) {
+			aij = A(i, j);
+			bj = b + (size_t) j * nb;
+			for (c = 0; c < nb; c++)
+				bi[c] -= aij * bj[c];
+		}
+		for (c = 0; c < nb; c++)
+			bi[c] /= A(i, i);
 	}
 }
+#else
+
+/*
+ *    LAPACK versions
+ *
+ *    A matrix stored row by row is its transpose stored column by column,
+ *    so dgetrf factors A' = P*L*U in place, with the pivots in indx
+ *    (numbered from 1).  Then A*X = B becomes X' = B'*inv(U)*inv(L)*P',
+ *    two triangular solves from the right with the rows of b as the
+ *    columns of B', followed by the row interchanges in reverse order.
+ */
+
+void dgetrf_();                 /* LAPACK LU decomposition */
+void dtrsm_();                  /* BLAS triangular solve, many r.h.s. */
+
+int ludcmp(a, n, lda, indx, d, vv)
+double *a;                      /* input matrix */
+int n;                          /* number of rows and columns in matrix a */
+int lda;                        /* row length of a */
+int *indx;                      /* row permutation from pivoting */
+float *d;                       /* +/- 1 for even or odd number of
+                                   row interchanges */
+double *vv;                     /* not used */
+{
+	int i;                       /* looping index */
+	int info;                    /* return value from dgetrf */
+
+	dgetrf_(&n, &n, a, &lda, indx, &info);
+	if (info != 0)
+		return(1);
+	*d = 1.0;
+	for (i = 0; i < n; i++)
+		if (indx[i] != i + 1)
+			*d = -(*d);
+	return(0);
+}
+
+/*
+ *    Solve with the factors from ludcmp() for the nb right-hand sides in
+ *    the rows of b (row i of the solution starts at b[i*ldb])
+ */
+
+static void lusolvt(a, n, lda, indx, b, nb, ldb)
+double *a;                      /* LU decomposed matrix */
+int n;                          /* number of rows and columns in matrix a */
+int lda;                        /* row length of a */
+int *indx;                      /* row permutation from pivoting */
+double *b;                      /* right-hand sides / solutions */
+int nb;                         /* number of right-hand sides */
+int ldb;                        /* row length of b */
+{
+	int c, i;                    /* looping indexes */
+	int ip;                      /* index value */
+	double one = 1.0;            /* scale factor for dtrsm */
+	double temp;                 /* temporary variable */
+
+	dtrsm_("R", "U", "N", "N", &nb, &n, &one, a, &lda, b, &ldb);
+	dtrsm_("R", "L", "N", "U", &nb, &n, &one, a, &lda, b, &ldb);
+	for (i = n-1; i >= 0; i--) {
+		ip = indx[i] - 1;
+		if (ip != i)
+			for (c = 0; c < nb; c++) {
+				temp = b[(size_t) i * ldb + c];
+				b[(size_t) i * ldb + c] = b[(size_t) ip * ldb + c];
+				b[(size_t) ip * ldb + c] = temp;
+			}
+	}
+}
+
+void lubksb(a, n, lda, indx)
+double *a;                      /* input matrix */
+int n;                          /* number of rows and columns in matrix a */
+int lda;                        /* row length of a (at least n+1) */
+int *indx;                      /* row permutation from pivoting */
+{
+	lusolvt(a, n, lda, indx, a + n, 1, lda);
+}
+
+void lubksbm(a, n, lda, indx, b, nb)
+double *a;                      /* LU decomposed matrix */
+int n;                          /* number of rows and columns in matrix a */
+int lda;                        /* row length of a */
+int *indx;                      /* row permutation from pivoting */
+double *b;                      /* right-hand sides / solutions */
+int nb;                         /* number of right-hand sides */
+{
+	lusolvt(a, n, lda, indx, b, nb, nb);
+}
+
+#endif
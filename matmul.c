@@ -0,0 +1,87 @@
+/*
+ *    matmul.c
+ *
+ *    Dense matrix products of the weight engine and of the grid loops
+ *
+ *    Matrices are stored row by row in one contiguous block.  When
+ *    compiled with USE_LAPACK (see makefile), the products are done by
+ *    dgemm and sgemm of a system BLAS; otherwise by the loops here.  A
+ *    matrix stored row by row is its transpose stored column by column,
+ *    so the BLAS routines are called for the transposed products.
+ */
+
+#include <stdio.h>
+
+#ifdef USE_LAPACK
+void dgemm_();                   /* BLAS matrix-matrix product */
+void sgemm_();                   /* BLAS single precision matrix-matrix
+                                    product */
+#endif
+
+/*
+ *    c = a * b, where a is m x k, b is k x n, and c is m x n
+ */
+
+void dmatmul(m, n, k, a, b, c)
+int m;                           /* number of rows of a and c */
+int n;                           /* number of columns of b and c */
+int k;                           /* number of columns of a and rows of b */
+double *a;                       /* left matrix (row i starts at a[i*k]) */
+double *b;                       /* right matrix (row i starts at b[i*n]) */
+double *c;                       /* product (row i starts at c[i*n]) */
+{
+#ifdef USE_LAPACK
+	double one = 1.0;             /* scale factor of product */
+	double zero = 0.0;            /* scale factor of c */
+
+	dgemm_("N", "N", &n, &m, &k, &one, b, &n, a, &k, &zero, c, &n);
+#else
+	double aij;                   /* element of a */
+	int i, j, l;                  /* loop indexes */
+
+	for (i = 0; i < m; i++) {
+		for (l = 0; l < n; l++)
+			c[(size_t) i * n + l] = 0;
+		for (j = 0; j < k; j++) {
+			aij = a[(size_t) i * k + j];
+			for (l = 0; l < n; l++)
+				c[(size_t) i * n + l] += aij * b[(size_t) j * n + l];
+		}
+	}
+#endif
+}
+
+/*
+ *    c = c + a * b, where a is m x k, b is k x n, and c is m x n.  In the
+ *    loops here each element of c has the products added to it one at a
+ *    time, in the order of the columns of a, so that a product with one
+ *    column of b gives the same sums as one with all of them; BLAS adds
+ *    them in its own order.
+ */
+
+void smatmul(m, n, k, a, b, c)
+int m;                           /* number of rows of a and c */
+int n;                           /* number of columns of b and c */
+int k;                           /* number of columns of a and rows of b */
+float *a;                        /* left matrix (row i starts at a[i*k]) */
+float *b;                        /* right matrix (row i starts at b[i*n]) */
+float *c;                        /* product (row i starts at c[i*n]),
+                                    added to */
+{
+#ifdef USE_LAPACK
+	float one = 1.0;              /* scale factor of product and c */
+
+	sgemm_("N", "N", &n, &m, &k, &one, b, &n, a, &k, &one, c, &n);
+#else
+	float aij;                    /* element of a */
+	int i, j, l;                  /* loop indexes */
+
+	for (i = 0; i < m; i++) {
+		for (j = 0; j < k; j++) {
+			aij = a[(size_t) i * k + j];
+			for (l = 0; l < n; l++)
+				c[(size_t) i * n + l] += aij * b[(size_t) j * n + l];
+		}
+	}
+#endif
+}
@@ -6,6 +6,10 @@
  *    netcdf_create - creates the netcdf file to start writing to
  *    netcdf_write - Write the data to a netcdf file
  *
+ *    Modification, October 2026:
+ *       Added a second variable for the kriging variance grids
+ *       (kriging-variance setting)
+ *
  *    A little bit about chunking:
  *    http://www.unidata.ucar.edu/blogs/developer/en/entry/chunking_data_why_it_matters
  *    http://www.unidata.ucar.edu/blogs/developer/en/entry/chunking_data_choosing_shapes
@@ -21,6 +25,7 @@
 /* This is the name of the data file we will create. */
 #define DK_TITLE "Created with DK 4.8 tool"
 #define VAR_NAME "variable"
+#define KV_NAME "kriging_variance"
 #define CONVENTION "CF-1.6 (http://cfconventions.org/Data/cf-conventions/cf-conventions-1.6/build/cf-conventions.pdf)"
 #define FILE_NAME "dk_out_%i.nc"
 
@@ -38,7 +43,7 @@
 /*
  * Create the netcdf file
  */
-int netcdf_create(iy, x, y, nx, ny, ncid)
+int netcdf_create(iy, x, y, nx, ny, ncid, kv)
 int iy;                          /* year */
 //struct grid *grid;							/* grid structure */
 float *x;
@@ -46,11 +51,12 @@ float *y;
 int nx;								/* number of values in x index */
 int ny;								/* number of values in y index */
 int *ncid;							/* file id for netcdf file */
+int kv;								/* 1 = add variable for kriging variance */
 {
 
 	/* When we create netCDF variables and dimensions, we get back an
 	 * ID for each one. */
-	int t_dimid, x_dimid, y_dimid, varid[3];
+	int t_dimid, x_dimid, y_dimid, varid[5];
 	int dimids[NDIMS];
 //	int dimids2[2];
 	size_t chunkSizes[3];
@@ -137,6 +143,18 @@ int *ncid;							/* file id for netcdf file */
 		if ((retval = nc_def_var_chunking(*ncid, varid[3], NC_CHUNKED, &chunkSizes[0])))
 			ERR(retval);
 
+		/* Define kriging variance variable if wanted */
+		if (kv == 1) {
+			if ((retval = nc_def_var(*ncid, KV_NAME, NC_FLOAT, NDIMS, dimids, &varid[4])))
+				ERR(retval);
+			if ((retval = nc_put_att_text(*ncid, varid[4], "units", strlen("distance"), "distance")))
+				ERR(retval);
+			if ((retval = nc_put_att_text(*ncid, varid[4], "long_name", strlen("ordinary kriging variance"), "ordinary kriging variance")))
+				ERR(retval);
+			if ((retval = nc_def_var_chunking(*ncid, varid[4], NC_CHUNKED, &chunkSizes[0])))
+				ERR(retval);
+		}
+
 		/* Add global attributes for file */
 		if ((retval = nc_put_att_int(*ncid, NC_GLOBAL, "Water_Year", NC_INT, 1, &iy)))
 			ERR(retval);
@@ -183,19 +201,20 @@ int *ncid;							/* file id for netcdf file */
 /*
  * Write the data to the netcdf file
  */
-int netcdf_write(ncid, ip, data, nx, ny)
+int netcdf_write(ncid, ip, data, nx, ny, kv)
 int *ncid;						/* file id for netcdf file */
 int ip;                          /* period (sequential number beginning Oct 1) */
 float *data;						 /* pointer to data matrix */
 int nx;								/* number of values in x index */
 int ny;								/* number of values in y index */
+int kv;								/* 1 = kriging variance grid */
 {
 
 	int varid;		/* variable id */
 	int retval;		/* indexing and error handling. */
 
 	/* get variable id */
-	if ((retval = nc_inq_varid(*ncid, VAR_NAME, &varid)))
+	if ((retval = nc_inq_varid(*ncid, (kv == 1) ? KV_NAME : VAR_NAME, &varid)))
 		ERR(retval);
 
 	/* location to put the data */
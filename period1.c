@@ -77,19 +77,19 @@ void period1()
 				adata[i] = 0;
 				for (n = 0; n < nstop; n++) {
 					j = jj + n;
-					if (type == 1 && (sta[i].data[j][k] > accum
-							&&  sta[i].data[j][k] < replace)) {
+					if (type == 1 && (DATA(i, j, k) > accum
+							&&  DATA(i, j, k) < replace)) {
 						if (intval[i] <= 0)
 							intval[i] = interp(i, j, k);
 						adata[i] += intval[i];
 					}
-					else if (type == 1 && (sta[i].data[j][k] > replace
-							&&  sta[i].data[j][k] < missing)) {
+					else if (type == 1 && (DATA(i, j, k) > replace
+							&&  DATA(i, j, k) < missing)) {
 						adata[i] += intval[i];
 						intval[i] = -1;
 					}
-					else if (sta[i].data[j][k] < missing)
-						adata[i] += sta[i].data[j][k];
+					else if (DATA(i, j, k) < missing)
+						adata[i] += DATA(i, j, k);
 					else {
 						adata[i] = 99999;
 						break;
@@ -108,7 +108,7 @@ void period1()
 					izero = 1;
 					for (i = 0; i < nsta; i++) {
 						if (adata[i] <= 99998) {
-							if (sta[i].data[j][k] > 0.001) {
+							if (DATA(i, j, k) > 0.001) {
 								izero = 0;
 								break;
 							}
@@ -218,8 +218,8 @@ if (m == 8 && year[k] == 69) {
 						dum = b0[m][k] + b1[m][k] * sta[i].elev;
 						for (n = 0; n < nstop; n++) {
 							j = jj + n;
-							if (map[j][k] > missing && sta[i].data[j][k] < accum)
-								sta[i].data[j][k] -= dum;
+							if (map[j][k] > missing && DATA(i, j, k) < accum)
+								DATA(i, j, k) -= dum;
 						}
 					}
 					//					}
@@ -4,12 +4,40 @@
  *    David Garen  9/92
  *
  *    Compute MAP/MAT based on dpp-day periods.
+ *
+ *    Modification, October 2026:
+ *       Added kriging variance grids, written alongside the estimated
+ *       grids when kriging-variance is set
+ *
+ *    Modification, October 2026:
+ *       Periods are kriged in parallel, KTBATCH periods per thread at a
+ *       time, each into the grids of its thread (tstep.c).  The weights
+ *       for days with missing stations are fetched from the weight cache
+ *       before each batch, and the grids are written out in period order.
+ *       On a grid of KGPAR or more used cells, the periods are kriged one
+ *       at a time instead, with the grid loop of each day in parallel.
+ *
+ *    Modification, October 2026:
+ *       With one day per period, runs of up to KTRUN consecutive periods
+ *       with the same stations with data are kriged together, as one
+ *       product of their weights and the residuals of all of the periods
+ *       (tstep_krige())
+ *
+ *    Modification, October 2026:
+ *       With table output only, MAP/MAT and zonal means are computed from
+ *       sums of the weights over the grid cells (period2_agg()) for days
+ *       kriged with all stations or equal weights, without the grids,
+ *       unless an estimate could be set to zero
  */
 
+#include <math.h>
+#include <omp.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
-#include <math.h>
 
+#include "dk_m.h"
 #include "dk_x.h"
 
 int netcdf_create();
@@ -17,18 +45,580 @@ int netcdf_write();
 int netcdf_close();
 int netcdf_timesteps();
 
+/*
+ *    Finish used grid cells u0 to u1-1 of grid t of a run for day j of
+ *    period m of year k, and return the sum of the estimates of those
+ *    cells used for the spatial average.  The grid already holds the
+ *    kriged residuals (tstep_krige()), except with equal weights, which
+ *    are applied here.
+ */
+
+static float period2_cells(u0, u1, t, j, k, m, imiss, ns, wmiss, ts)
+int u0, u1;                      /* first and last+1 used grid cells */
+int t;                           /* timestep of run */
+int j;                           /* day */
+int k;                           /* year */
+int m;                           /* period */
+int imiss;                       /* 1 = one or more stations have missing
+                                    data */
+int ns;                          /* number of stations with data */
+float *wmiss;                    /* kriging weights for stations with data
+                                    (used grid cells x ns) */
+struct tstep *ts;                /* buffers of run */
+{
+	float dum;                    /* sum of grid values */
+	float *g;                     /* estimates at used grid cells */
+	int i, l, u;                  /* loop indexes */
+	float *v;                     /* kriging variances at used grid
+                                    cells */
+
+	g = ts->g + (size_t) t * ngriduse;
+	v = (ivar == 1) ? ts->v + (size_t) t * ngriduse : NULL;
+
+	dum = 0;
+	for (u = u0; u < u1; u++) {
+		l = iuse[u];
+
+		/* KRIGING - Calculate detrended values at grid cell */
+		if (imiss == 1 && iwt != 1) {
+			for (i = 0; i < nsta; i++)
+				g[u] += (float) ((ts->w[i] * DATA(i, j, k)));
+		}
+
+		/* Kriging variance at grid cell */
+
+		if (ivar == 1)
+			v[u] = (imiss == 1) ?
+					wmiss[(size_t) ngriduse * ns + u] : wvar[l];
+
+		/* Re-trend grid prec/temp */
+		g[u] += (b0[m][k] + b1[m][k] * grid[l].elev);
+
+		/* Set grid prec values to zero if estimate is less than zero */
+
+		if (g[u] < 0 && type == 1)
+			g[u] = 0;
+
+		/* Add grid prec/temp to basin sum */
+
+		if (imask == 0 || (imask == 1 && grid[l].mask == 1))
+			dum += g[u];
+
+		/* round value */
+		if (roundVal != -99)
+			g[u] = round(g[u] * roundVal) / roundVal;
+	}
+	return(dum);
+}
+
+/*
+ *    Sums of the kriging weights for all stations and of the elevations
+ *    over the used grid cells of the spatial average and of each zone,
+ *    for finding the means of a day without its grid (table output
+ *    only).  The mean of the estimates of a set of cells is the sum of
+ *    the weights of each station over those cells times its residual,
+ *    plus the detrending line at the sum of their elevations, divided by
+ *    the number of cells, as long as no estimate is set to zero.
+ */
+
+static struct {
+	int na;                       /* number of cells of the spatial
+	                                 average */
+	double *wa;                   /* weights of each station summed over
+	                                 the cells of the spatial average */
+	double ea;                    /* elevations summed over the cells of
+	                                 the spatial average */
+	int *nz;                      /* number of used cells of each zone */
+	double *wz;                   /* weights of each station summed over
+	                                 the cells of each zone (nzone x
+	                                 nsta) */
+	double *ez;                   /* elevations summed over the cells of
+	                                 each zone */
+	float *wmin, *wmax;           /* smallest and largest weight of each
+	                                 station over the used cells */
+	float emin, emax;             /* smallest and largest elevation of the
+	                                 used cells */
+} agg;
+
+/*
+ *    Compute the sums of agg
+ */
+
+static void period2_agg()
+{
+	int i, l, u, z;               /* loop indexes */
+
+	agg.wa = dvector(nsta);
+	agg.wmin = vector(nsta);
+	agg.wmax = vector(nsta);
+	for (i = 0; i < nsta; i++)
+		agg.wa[i] = 0;
+	agg.ea = 0;
+	agg.na = 0;
+	if (izone == 1) {
+		agg.nz = ivector(nzone);
+		agg.wz = dvector(nzone * nsta);
+		agg.ez = dvector(nzone);
+		for (z = 0; z < nzone; z++) {
+			agg.nz[z] = 0;
+			agg.ez[z] = 0;
+			for (i = 0; i < nsta; i++)
+				agg.wz[z * nsta + i] = 0;
+		}
+	}
+
+	for (u = 0; u < ngriduse; u++) {
+		l = iuse[u];
+		for (i = 0; i < nsta; i++) {
+			if (u == 0 || wall[l][i] < agg.wmin[i])
+				agg.wmin[i] = wall[l][i];
+			if (u == 0 || wall[l][i] > agg.wmax[i])
+				agg.wmax[i] = wall[l][i];
+		}
+		if (u == 0 || grid[l].elev < agg.emin)
+			agg.emin = grid[l].elev;
+		if (u == 0 || grid[l].elev > agg.emax)
+			agg.emax = grid[l].elev;
+		if (imask == 0 || (imask == 1 && grid[l].mask == 1)) {
+			for (i = 0; i < nsta; i++)
+				agg.wa[i] += wall[l][i];
+			agg.ea += grid[l].elev;
+			agg.na++;
+		}
+		if (izone == 1) {
+			for (z = 0; z < nzone; z++)
+				if (grid[l].zone == zone[z].number)
+					break;
+			if (z < nzone) {
+				for (i = 0; i < nsta; i++)
+					agg.wz[z * nsta + i] += wall[l][i];
+				agg.ez[z] += grid[l].elev;
+				agg.nz[z]++;
+			}
+		}
+	}
+}
+
+/*
+ *    Return 1 if the means of the days of a run of nr periods of year k,
+ *    starting with period m, can be found without their grids, 0 if not.
+ *    This is so if each day is kriged with the weights for all stations
+ *    or with equal weights, and, for precipitation, no estimate can be
+ *    less than zero: the smallest possible estimate, with each residual
+ *    times the smallest (positive residual) or largest (negative
+ *    residual) weight of its station and the detrending line at the
+ *    lowest or highest elevation, is not negative.  Rounded values are
+ *    added together over the days of a period, and averaged into zonal
+ *    means, so then only single days without zones qualify.
+ */
+
+static int period2_fast(k, m, nr, nstop)
+int k;                           /* year */
+int m;                           /* first period of run */
+int nr;                          /* number of periods in run */
+int nstop;                       /* number of days in period */
+{
+	double est;                   /* smallest possible estimate */
+	int i, j, n, t;               /* loop indexes */
+	int ns;                       /* number of stations with data */
+	float r;                      /* residual of station */
+
+	if (b0[m][k] > 99998 || b1[m][k] > 99998)
+		return(0);
+	if (roundVal != -99 && (nstop > 1 || izone == 1))
+		return(0);
+	for (t = 0; t < nr; t++) {
+		for (n = 0; n < nstop; n++) {
+			j = dpp * (m + t) + firstday[k] - 1 + n;
+			if (map[j][k] <= missing)
+				continue;
+			ns = 0;
+			for (i = 0; i < nsta; i++)
+				if (DATA(i, j, k) < accum)
+					ns++;
+			if (ns <= 1)
+				continue;
+			if (ns < nsta && iwt != 2)
+				return(0);
+			if (type != 1)
+				continue;
+			est = 0;
+			for (i = 0; i < nsta; i++) {
+				r = DATA(i, j, k);
+				if (ns < nsta)
+					est += (r < accum) ? r / ns : 0;
+				else
+					est += r * ((r > 0) ? agg.wmin[i] : agg.wmax[i]);
+			}
+			est += b0[m+t][k] + ((b1[m+t][k] > 0) ?
+					b1[m+t][k] * agg.emin : b1[m+t][k] * agg.emax);
+			if (est < 0)
+				return(0);
+		}
+	}
+	return(1);
+}
+
+/*
+ *    Compute the means of the days of a run of nr periods of year k,
+ *    starting with period m, from the sums of agg, for a run for which
+ *    period2_fast() is 1.  As with the grids, the days of a period are
+ *    added together.  act[n] is set for day n of the run to 3 if the
+ *    means were computed, 2 if all stations have zero values, and 0
+ *    otherwise; the zonal means are put in zm.
+ */
+
+static void period2_mean(k, m, nr, nstop, act, ts)
+int k;                           /* year */
+int m;                           /* first period of run */
+int nr;                          /* number of periods in run */
+int nstop;                       /* number of days in period */
+int *act;                        /* what was done for each day */
+struct tstep *ts;                /* buffers of calling thread */
+{
+	double a;                     /* mean of equal-weight estimates */
+	double bb0, bb1;              /* detrending coefficients */
+	double cz[MZONE];             /* sums of estimates over each zone */
+	double dum;                   /* sum of estimates */
+	int i, j, n, t, z;            /* loop indexes */
+	int ns;                       /* number of stations with data */
+	float r;                      /* residual of station */
+
+	for (t = 0; t < nr; t++) {
+		bb0 = b0[m+t][k];
+		bb1 = b1[m+t][k];
+		dum = 0;
+		for (z = 0; z < nzone && izone == 1; z++)
+			cz[z] = 0;
+		for (n = 0; n < nstop; n++) {
+			j = dpp * (m + t) + firstday[k] - 1 + n;
+			if (map[j][k] <= missing) {
+				act[t+n] = 2;
+				continue;
+			}
+			ns = 0;
+			for (i = 0; i < nsta; i++)
+				if (DATA(i, j, k) < accum)
+					ns++;
+			if (ns <= 1)
+				continue;
+
+			/* Equal weights give the same detrended value everywhere */
+
+			if (ns < nsta) {
+				a = 0;
+				for (i = 0; i < nsta; i++)
+					if ((r = DATA(i, j, k)) < accum)
+						a += r / ns;
+				dum += agg.na * (a + bb0) + bb1 * agg.ea;
+				for (z = 0; z < nzone && izone == 1; z++)
+					cz[z] += agg.nz[z] * (a + bb0) + bb1 * agg.ez[z];
+			}
+			else {
+				for (i = 0; i < nsta; i++)
+					dum += agg.wa[i] * DATA(i, j, k);
+				dum += agg.na * bb0 + bb1 * agg.ea;
+				for (z = 0; z < nzone && izone == 1; z++) {
+					for (i = 0; i < nsta; i++)
+						cz[z] += agg.wz[z * nsta + i] * DATA(i, j, k);
+					cz[z] += agg.nz[z] * bb0 + bb1 * agg.ez[z];
+				}
+			}
+
+			/* Compute MAP/MAT for day */
+
+			if (imask == 0)
+				map[j][k] = dum / ngriduse;
+			else
+				map[j][k] = dum / nmask;
+			for (z = 0; z < nzone && izone == 1; z++)
+				ts->zm[(t + n) * nzone + z] = cz[z] / zone[z].ncells;
+			act[t+n] = 3;
+		}
+	}
+}
+
+/*
+ *    Krige the days of a run of nr periods of year k, starting with
+ *    period m, into the grids of the calling thread, one grid for each
+ *    period; a run of more than one period has one day per period.  The
+ *    estimates of the days of a period are added together.  act[n] is
+ *    set for day n of the run to 1 if the day was kriged, 2 if all
+ *    stations have zero values, and 0 otherwise.  The grids of kriged
+ *    days other than the last of a period are copied to gd and vd if
+ *    they are to be written out.  With table output only, the means of
+ *    a run are computed without the grids if they can be
+ *    (period2_mean()).
+ */
+
+static void period2_per(k, m, nr, nstop, wday, act, ts)
+int k;                           /* year */
+int m;                           /* first period of run */
+int nr;                          /* number of periods in run */
+int nstop;                       /* number of days in period */
+float **wday;                    /* kriging weights for days with missing
+                                    stations, by day */
+int *act;                        /* what was done for each day */
+struct tstep *ts;                /* buffers of calling thread */
+{
+	int b;                        /* block of used grid cells */
+	float dum[KTRUN];             /* sums of grid values */
+	int i, j, l, n, t;            /* loop indexes */
+	int imiss;                    /* 1 = one or more stations have missing
+	                                 data */
+	int jj;                       /* first day of period */
+	int nblk;                     /* number of blocks of used grid cells */
+	int ns;                       /* number of stations with data */
+	int tj[KTRUN];                /* day of each period of run */
+	int u0, u1;                   /* first and last+1 used grid cells of
+	                                 block */
+	float *wmiss = NULL;          /* kriging weights for stations with data
+	                                 (used grid cells x ns) */
+
+	for (n = 0; n < nr * nstop; n++)
+		act[n] = 0;
+	if (iout == 1 && period2_fast(k, m, nr, nstop) == 1) {
+		period2_mean(k, m, nr, nstop, act, ts);
+		return;
+	}
+
+	/* create arrays of empty zeros*/
+	for (l = 0; l < nr * ngriduse; l++)
+		ts->g[l] = 0;
+
+	/* Process all days that have valid detrending coefficients */
+
+	if (b0[m][k] > 99998 || b1[m][k] > 99998)
+		return;
+	jj = dpp * m + firstday[k] - 1;
+
+	/* Day loop */
+
+	for (n = 0; n < nstop; n++) {
+		j = jj + n;
+
+		/* Process days that have not been set to zero because
+		   all stations have zero values (precipitation, SWE) */
+
+		if (map[j][k] <= missing) {
+			act[n] = 2;
+			continue;
+		}
+
+		/* Check to see if any stations have missing data (the same for
+		   all of the periods of a run) */
+
+		imiss = ns = 0;
+		for (i = 0; i < nsta; i++)
+			if (DATA(i, j, k) < accum)
+				ns++;
+		if (ns <= 1)
+			continue;
+		if (ns < nsta) {
+			imiss = 1;
+			if (iwt == 2) {
+				for (i = 0; i < nsta; i++) {
+					if (DATA(i, j, k) < accum)
+						ts->w[i] = 1.0 / ns;
+					else
+						ts->w[i] = 0.0;
+				}
+			}
+
+			/* If one or more stations have missing data, use kriging
+			   weights excluding those stations (fetched from the weight
+			   cache by period2()); otherwise, use weights for all
+			   stations that have already been calculated */
+
+			else {
+				ns = 0;
+				for (i = 0; i < nsta; i++)
+					if (DATA(i, j, k) < accum)
+						ts->ista[ns++] = i;
+				wmiss = wday[j];
+			}
+		}
+
+		/* Residuals of the stations with data, one column for each
+		   period of the run */
+
+		for (t = 0; t < nr; t++) {
+			tj[t] = j + t;
+			if (imiss == 0 || iwt == 1)
+				for (i = 0; i < ns; i++)
+					ts->r[i * nr + t] =
+							DATA((imiss == 1) ? ts->ista[i] : i, tj[t], k);
+		}
+
+		/* Grid loop; on a large grid, blocks of used grid cells are
+		   kriged in parallel and their sums added in block order, so
+		   that the result does not depend on the number of threads */
+
+		if (ngriduse < KGPAR) {
+			if (imiss == 0 || iwt == 1)
+				tstep_krige(ts, nr, ns, (imiss == 1) ? wmiss : NULL, 0, ngriduse,
+						1);
+			for (t = 0; t < nr; t++)
+				dum[t] = period2_cells(0, ngriduse, t, tj[t], k, m + t, imiss,
+						ns, wmiss, ts);
+		}
+		else {
+			nblk = (ngriduse + KGBLK - 1) / KGBLK;
+#pragma omp parallel for schedule(static) private(t, u0, u1)
+			for (b = 0; b < nblk; b++) {
+				u0 = b * KGBLK;
+				u1 = (b + 1 < nblk) ? u0 + KGBLK : ngriduse;
+				if (imiss == 0 || iwt == 1)
+					tstep_krige(ts, nr, ns, (imiss == 1) ? wmiss : NULL, u0, u1,
+							1);
+				for (t = 0; t < nr; t++)
+					ts->bs[b * nr + t] = period2_cells(u0, u1, t, tj[t], k,
+							m + t, imiss, ns, wmiss, ts);
+			}
+			for (t = 0; t < nr; t++) {
+				dum[t] = 0;
+				for (b = 0; b < nblk; b++)
+					dum[t] += ts->bs[b * nr + t];
+			}
+		}
+
+		/* Compute MAP/MAT for day */
+
+		for (t = 0; t < nr; t++) {
+			if (imask == 0)
+				map[tj[t]][k] = dum[t] / ngriduse;
+			else
+				map[tj[t]][k] = dum[t] / nmask;
+			act[n + t] = 1;
+		}
+
+		/* Keep the grids of the day if they are to be written out and
+		   later days of the period will change them */
+
+		if (n < ts->nday && (izone == 1 ||
+				(iout >= 2 && iout <= 4 && j >= igridout1 && j <= igridout2))) {
+			memcpy(ts->gd + (size_t) n * ngriduse, ts->g,
+					ngriduse * sizeof(float));
+			if (ivar == 1)
+				memcpy(ts->vd + (size_t) n * ngriduse, ts->v,
+						ngriduse * sizeof(float));
+		}
+	}
+}
+
+/*
+ *    Write out the grids and zonal means of the days of a run of nr
+ *    periods of year k, starting with period m, kriged by period2_per();
+ *    the zonal means of days done by period2_mean() are in zm.  jl is
+ *    set to the day of the NETCDF grid of the last period.
+ */
+
+static void period2_out(k, m, nr, nstop, act, ts, ncid, jl)
+int k;                           /* year */
+int m;                           /* first period of run */
+int nr;                          /* number of periods in run */
+int nstop;                       /* number of days in period */
+int *act;                        /* what was done for each day */
+struct tstep *ts;                /* buffers of calling thread */
+int **ncid;                      /* file id for netcdf file */
+int *jl;                         /* day of NETCDF grid */
+{
+	float *g, *v;                 /* grids of day */
+	int a;                        /* what was done for day */
+	int j, jj, n, t, z;           /* loop indexes */
+
+	for (t = 0; t < nr; t++) {
+		jj = dpp * (m + t) + firstday[k] - 1;
+		for (n = 0; n < nstop; n++) {
+			j = jj + n;
+			a = act[t + n];
+			if (n < nstop - 1 && n < ts->nday && a == 1) {
+				g = ts->gd + (size_t) n * ngriduse;
+				v = (ivar == 1) ? ts->vd + (size_t) n * ngriduse : NULL;
+			}
+			else {
+				g = ts->g + (size_t) t * ngriduse;
+				v = (ivar == 1) ? ts->v + (size_t) t * ngriduse : NULL;
+			}
+
+			/* If requested, write out grids in GRASS, ARC/INFO, or IPW
+			   format */
+
+			if (a == 1)
+				tstep_write(year[k], j, g, v);
+
+			/* If requested, compute and write out zonal means for day;
+			   for zone output, write a line of output anyway if all
+			   stations have zero values */
+
+			if (a == 1 && izone == 1)
+				zoneout(year[k], j, 1, g);
+			else if (a == 3 && izone == 1) {
+				for (z = 0; z < nzone; z++)
+					zone[z].mean = ts->zm[(t + n) * nzone + z];
+				zoneout(year[k], j, 1, NULL);
+			}
+			else if (a == 2 && izone == 1)
+				zoneout(year[k], j, 0, g);
+		}
+		if (b0[m+t][k] <= 99998 && b1[m+t][k] <= 99998)
+			*jl = jj + nstop - 1;
+		else
+			*jl = jj;
+
+		/* If requested, write out grid in NETCDF format */
+		if (iout == 5 && *jl >= igridout1 && *jl <= igridout2) {
+			g = ts->g + (size_t) t * ngriduse;
+			netcdf_write(ncid, *jl, tstep_full(g), arc.cols, arc.rows, 0);
+			if (ivar == 1) {
+				v = ts->v + (size_t) t * ngriduse;
+				netcdf_write(ncid, *jl, tstep_full(v), arc.cols, arc.rows, 1);
+			}
+		}
+	}
+}
 
 void period2()
 {
-	int i, j, jj, k, l, m, n;  /* loop indexes */
-	int ns;                    /* number of stations with data */
-	int *staflg;				 	 /* station use flags*/
+	int *act;                     /* what was done for each day of the
+	                                 periods of a batch */
+	int i, j, jj, k, m, n, r;     /* loop indexes */
+	int len;                      /* number of days in period */
+	int m0, m1;                   /* first and last+1 periods of batch */
+	int nb;                       /* number of periods in a batch */
+	int ncopy;                    /* number of grids kept for the days of
+	                                 a period */
+	int nr;                       /* number of runs in batch */
+	int ns;                       /* number of stations with data */
+	int *pkind;                   /* weights of each period of batch, for
+	                                 runs (0 = none, 1 = all stations,
+	                                 2 = stations with data) */
+	int *rm, *rn;                 /* first period and number of periods of
+	                                 each run */
+	int *staflg;                  /* station use flags */
+	struct tstep *ts;             /* buffers of thread */
+	float **wday;                 /* kriging weights for days with missing
+	                                 stations, by day */
 	int *ncid;		/* file id for netcdf file */
 
 	// set station use flags
 	staflg = ivector(nsta);
 	for (m = 0; m < nsta; m++)
 		staflg[m] = 1;
+	wday = (float **) malloc(mtper * sizeof(float *));
+	if (!wday) {
+		printf("\n\nAllocation failure in period2().\n");
+		exit(0);
+	}
+	for (j = 0; j < mtper; j++)
+		wday[j] = NULL;
+	nb = KTBATCH * KTRUN * omp_get_max_threads();
+	act = ivector(nb * 2 * dpp);
+	pkind = ivector(nb);
+	rm = ivector(nb);
+	rn = ivector(nb);
+	if (iout == 1)
+		period2_agg();
 
 	/* Year loop */
 	for (k = 0; k < nyear; k++) {
@@ -36,199 +626,90 @@ void period2()
 		nper = n / dpp;
 		nperm1 = nper - 1;
 		dppl = n - dpp * nperm1;
-		nstop = dpp;
+		ncopy = 0;
+		if (izone == 1 || (iout >= 2 && iout <= 4))
+			ncopy = ((dppl > dpp) ? dppl : dpp) - 1;
+		j = firstday[k] - 1;
 
 		/* Create the netcdf file if wanted */
 		if (iout == 5) {
-			netcdf_create(year[k], xd, yd, arc.cols, arc.rows, &ncid);
-		}
-
-		/* Period loop */
-
-		for (m = 0; m < nper; m++) {
-			if (m == nperm1)
-				nstop = dppl;
-			jj = dpp * m + firstday[k] - 1;
-
-			/* create an array of empty zeros*/
-			for (l = 0; l < ngrid; l++)
-				gprec[l] = 0;
-
-			/* Process all days that have valid detrending coefficients */
-
-			if (b0[m][k] <= 99998 && b1[m][k] <= 99998) {
-
-				/* Day loop */
-
-				for (n = 0; n < nstop; n++) {
-					j = jj + n;
-					/* @@@ Progress "..." still needed?
-               printf("   %s%d%s%d%s%d%s\n",
-                      "Processing year ", year[k], ", period ", m+1,
-                      ", day ", j+1, " ...");
-					 */
-
-					/* Process days that have not been set to zero because
-                  all stations have zero values (precipitation, SWE) */
-
-					if (map[j][k] > missing) {
-
-						/* Check to see if any stations have missing data */
-
-						imiss = ns = 0;
-						for (i = 0; i < nsta; i++)
-							if (sta[i].data[j][k] < accum)
-								ns++;
-						if (ns <= 1)
-							continue;
-						if (ns < nsta) {
-							imiss = 1;
-							if (iwt == 2) {
-								for (i = 0; i < nsta; i++) {
-									if (sta[i].data[j][k] < accum)
-										w[i] = 1.0 / ns;
-									else
-										w[i] = 0.0;
-								}
-							}
-						}
-
-						/* Grid loop */
-
-						dum = 0;
-						for (l = 0; l < ngrid; l++) {
-							if (grid[l].use == 1) {
-
-								/* If one or more stations have missing data,
-                           calculate kriging weights excluding those stations;
-                           otherwise, use weights for all stations
-                           that have already been calculated */
-
-								if (iwt == 1 && imiss == 1) {
-									for (i = 0; i < nsta; i++) {
-										if (sta[i].data[j][k] < accum)
-											staflg[i] = 1;
-										else
-											staflg[i] = 0;
-									}
-									krige(l, ns);
-									//									w = krige(l, nsta, ad, dgrid, elevations);
-
-									/* Debug
-fprintf(fpout, "\nRevised weights:  Grid point %d, Year %d, Period %d\n",
-        l+1, year[k], m+1);
-for (i = 0; i < nsta; i++)
-   fprintf(fpout, "%8.4f", w[i]);
-fprintf(fpout, "\n");
-   End debug */
-								}
-
-
-								//								gprec[l] = 0;
-								/* KRIGING - Calculate detrended values at grid cell */
-								if (imiss == 1) {
-									for (i = 0; i < nsta; i++)
-										gprec[l] += (float) ((w[i] * sta[i].data[j][k]));
-								}
-								else {
-									for (i = 0; i < nsta; i++)
-										gprec[l] += (wall[l][i] * sta[i].data[j][k]);
-								}
-
-
-								/* Compute "retrended" precipitation at grid cell */
-								//								if (type == 1) {
-								//									float bi; /* new weight intercept for each station */
-								////									bi = vector(nsta);
-								//									float wp;
-								//									float tmp;
-								//									wp = 0;
-								//
-								//									/* Calculate the intercept at each station */
-								//									for (i = 0; i < nsta; i++) {
-								//										if (b1[m][k] <= 0)
-								//											b1[m][k] = 5;
-								//
-								//										bi = 1 - b1[m][k] * sta[i].elev; 		/* Make the station elevation have a weight of 1 */
-								//										tmp = b1[m][k] * grid[l].elev + bi;		/* Weight based on elevation around this station */
-								//										if (tmp < 0)
-								//											tmp = 0;
-								//										wp += wall[l][i] * tmp;
-								//									}
-								//
-								//									gprec[l] *= wp;	/* Multiply kriged value by the elevation trend */
-								//								}
-								//								else {
-								/* Re-trend grid prec/temp */
-								gprec[l] += (b0[m][k] + b1[m][k] * grid[l].elev);
-								//								}
-
-
-								/* Set grid prec values to zero if estimate is less than zero */
-
-								if (gprec[l] < 0 && type == 1)
-									gprec[l] = 0;
-
-								/* Add grid prec/temp to basin sum */
-
-								if (imask == 0 || (imask == 1 && grid[l].mask == 1))
-									dum += gprec[l];
-							}
-
-							/* round value */
-							if (roundVal != -99)
-								gprec[l] = round(gprec[l] * roundVal) / roundVal;
-
-
-						}
-
-						/* If requested, write out grid in GRASS format */
-
-						if (iout == 2 && j >= igridout1 && j <= igridout2)
-							grassout(year[k], j);
-
-						/* If requested, write out grid in ARC/INFO format */
-
-						if (iout == 3 && j >= igridout1 && j <= igridout2)
-							arcout(year[k], j);
-
-						/* If requested, write out grid in IPW format */
-
-						if (iout == 4 && j >= igridout1 && j <= igridout2)
-							ipwout(year[k], j);
-
-						/* If requested, compute and write out zonal means for day */
-
-						if (izone == 1)
-							zoneout(year[k], j, 1);
-
-						/* Compute MAP/MAT for day */
-
-						if (imask == 0)
-							map[j][k] = dum / ngriduse;
-						else
-							map[j][k] = dum / nmask;
-					}
-					else {
-
-						/* For zone output, write a line of output anyway
-                     if all stations have zero values */
+			netcdf_create(year[k], xd, yd, arc.cols, arc.rows, &ncid, ivar);
+		}
 
-						if (izone == 1)
-							zoneout(year[k], j, 0);
+		/* Period loop, a batch of periods at a time */
+
+		for (m0 = 0; m0 < nper; m0 = m1) {
+			m1 = (m0 + nb < nper) ? m0 + nb : nper;
+
+			/* Get kriging weights for the days of the batch with missing
+			   stations (calculated once for each pattern of missing
+			   stations).  The batch ends with the period of a weight set
+			   that is not held in the cache, so that such sets are freed
+			   as soon as they have been used. */
+
+			for (m = m0; m < m1; m++) {
+				pkind[m-m0] = 0;
+				if (b0[m][k] > 99998 || b1[m][k] > 99998)
+					continue;
+				jj = dpp * m + firstday[k] - 1;
+				len = (m == nperm1) ? dppl : dpp;
+				for (n = 0; n < len; n++) {
+					if (map[jj+n][k] <= missing)
+						continue;
+					ns = 0;
+					for (i = 0; i < nsta; i++) {
+						staflg[i] = (DATA(i, jj+n, k) < accum);
+						ns += staflg[i];
 					}
-
+					if (len == 1 && ns == nsta)
+						pkind[m-m0] = 1;
+					if (ns <= 1 || ns == nsta || iwt == 2)
+						continue;
+					wday[jj+n] = kwcache_get(staflg, ns);
+					if (len == 1)
+						pkind[m-m0] = 2;
+					if (kwcache_held(wday[jj+n]) == 0)
+						m1 = m + 1;
 				}
+			}
 
+			/* Runs of one-day periods with the same weights */
+
+			nr = 0;
+			for (m = m0; m < m1; m++) {
+				jj = m + firstday[k] - 1;
+				if (nr > 0 && pkind[m-m0] != 0 && rn[nr-1] < KTRUN &&
+						pkind[m-m0] == pkind[rm[nr-1]-m0] &&
+						wday[jj] == wday[jj-rn[nr-1]])
+					rn[nr-1]++;
+				else {
+					rm[nr] = m;
+					rn[nr++] = 1;
+				}
 			}
-			else
-				j = jj;
 
-			/* If requested, write out grid in NETCDF format */
-			//			printf("%i\n",j);
-			if (iout == 5 && j >= igridout1 && j <= igridout2)
-				netcdf_write(&ncid, j, gprec, arc.cols, arc.rows);
+			/* Krige the runs of the batch in parallel, and write out the
+			   grids in period order */
+
+#pragma omp parallel for ordered schedule(dynamic) private(len, m, ts) \
+		if(ngriduse < KGPAR)
+			for (r = 0; r < nr; r++) {
+				m = rm[r];
+				len = (m == nperm1) ? dppl : dpp;
+				ts = tstep_get(ncopy);
+				period2_per(k, m, rn[r], len, wday, act + (m - m0) * 2 * dpp,
+						ts);
+#pragma omp ordered
+				period2_out(k, m, rn[r], len, act + (m - m0) * 2 * dpp, ts,
+						&ncid, &j);
+			}
 
+			for (n = 0; n < mtper; n++) {
+				if (wday[n] != NULL) {
+					kwcache_release(wday[n]);
+					wday[n] = NULL;
+				}
+			}
 		}
 
 		if (iout == 5) {
@@ -236,4 +717,20 @@ fprintf(fpout, "\n");
 			netcdf_close(&ncid);
 		}
 	}
+	if (iout == 1) {
+		free(agg.wa);
+		free(agg.wmin);
+		free(agg.wmax);
+		if (izone == 1) {
+			free(agg.nz);
+			free(agg.wz);
+			free(agg.ez);
+		}
+	}
+	free(act);
+	free(pkind);
+	free(rm);
+	free(rn);
+	free(staflg);
+	free(wday);
 }
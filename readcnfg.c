@@ -384,6 +384,76 @@ void get_file_configuration(char configuration_filename[101])
 				N = atoi(value);
 			}
 		}
+		else if (strcmp(name, "search-radius-km") == 0) {
+			if (strlen(value) == 0)
+				srad = -99;
+			else
+				srad = atof(value);
+		}
+		else if (strcmp(name, "search-radius-min-stations") == 0) {
+			if (strlen(value) > 0)
+				sradmin = atoi(value);
+		}
+		else if (strcmp(name, "search-radius-max-stations") == 0) {
+			if (strlen(value) == 0)
+				sradmax = -99;
+			else
+				sradmax = atoi(value);
+		}
+		else if (strcmp(name, "weight-engine") == 0) {
+			switch (value[0]) {
+			case '1':
+				// Solve kriging system for each grid cell
+				iweng = 1;
+				break;
+			case '3':
+				// Closed-form weights from inverse of station matrix
+				iweng = 3;
+				break;
+			default:
+				// Factor station matrix once for all grid cells
+				iweng = 2;
+			}
+		}
+		else if (strcmp(name, "kriging-solver") == 0) {
+			switch (value[0]) {
+			case '1':
+				// LU decomposition of bordered kriging matrix
+				isolv = 1;
+				break;
+			case '3':
+				// Symmetric solver, checked against LU decomposition
+				isolv = 3;
+				break;
+			case '4':
+				// Symmetric solver in single precision with
+				// double-precision iterative refinement
+				isolv = 4;
+				break;
+			default:
+				// Symmetric solver (LU if matrix is unsuitable)
+				isolv = 2;
+			}
+		}
+		else if (strcmp(name, "kriging-variance") == 0) {
+			if (strcmp(value, "true") == 0)
+				ivar = 1;
+		}
+		else if (strcmp(name, "elimination-warm-start") == 0) {
+			if (strcmp(value, "true") == 0)
+				iwarm = 1;
+		}
+		else if (strcmp(name, "weight-cache-mb") == 0) {
+			if (strlen(value) > 0)
+				kwcmb = atof(value);
+		}
+		else if (strcmp(name, "factor-cache-mb") == 0) {
+			if (strlen(value) > 0)
+				kfcmb = atof(value);
+		}
+		else if (strcmp(name, "weight-cache-dir") == 0) {
+			strcpy(kwdir, value);
+		}
 		else if (strcmp(name, "nbits") == 0) {
 			if (strlen(value) == 0) {
 				nbits = 8;
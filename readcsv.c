@@ -24,6 +24,15 @@
  *       Removed leading space in reading "date_start", "date_end",
  *       and "missing_value".  Apparently this space was in early
  *       versions of the data csv file, but it is no longer there.
+ *
+ *    Modification, October 2026:
+ *       The data are held in one array for all stations, stdata (see
+ *       DATA() in dk_m.h), with room for mtper days a year; days beyond
+ *       mtper are skipped
+ *
+ *    Modification, October 2026:
+ *       stdata is allocated aligned to 64 bytes (avector()), with its
+ *       size counted in size_t
  */
 
 #include <malloc/malloc.h>
@@ -31,6 +40,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "dk_m.h"
 #include "dk_x.h"
 
 void readcsv()
@@ -283,12 +293,11 @@ void readcsv()
 
    /* Allocate space for data matrix and initialize to missing */
 
-   for (i = 0; i < nsta; i++) {
-      sta[i].data = matrix(366, nyear);
-      for (j = 0; j < 366; j++)
-         for (k = 0; k < nyear; k++)
-            sta[i].data[j][k] = missing;
-   }
+   stdata = avector((size_t) nsta * mtper * nyear);
+   for (k = 0; k < nyear; k++)
+      for (j = 0; j < mtper; j++)
+         for (i = 0; i < nsta; i++)
+            DATA(i, j, k) = missing;
 
    /* Read data */
 
@@ -322,9 +331,9 @@ void readcsv()
             buf[j] = '\0';
             value = (float) atof(buf);
             /* Set data value if not missing */
-            if ((val_miss < 0.0 && value > (val_miss + 0.1)) ||
-                (val_miss > 0.0 && value < (val_miss - 0.1)))
-               sta[i].data[iwyjd-1][iyr] = value;
+            if (iwyjd <= mtper && ((val_miss < 0.0 && value > (val_miss + 0.1)) ||
+                (val_miss > 0.0 && value < (val_miss - 0.1))))
+               DATA(i, iwyjd-1, iyr) = value;
             /* Check for end of line, otherwise advance a character */
             if (line[k] == '\0')
                break;
@@ -7,12 +7,22 @@
  *
  *    Modified for Version 4.7 by adding variable mtper (to replace 366)
  *    and removing dayfrac
+ *
+ *    Modification, October 2026:
+ *       The data of all stations are held in one array, stdata, with the
+ *       stations of each time step next to each other (see DATA() in
+ *       dk_m.h), instead of a matrix for each station
+ *
+ *    Modification, October 2026:
+ *       stdata is allocated aligned to 64 bytes (avector()), with its
+ *       size counted in size_t
  */
 
 #include <malloc/malloc.h>
 #include <stdio.h>
 #include <string.h>
 
+#include "dk_m.h"
 #include "dk_x.h"
 
 void readdata()
@@ -41,8 +51,16 @@ void readdata()
 
 /* fscanf(fpin1, "%d", &dayfrac); */
 
+   /* Allocate array space for data and initialize to missing */
+
+   stdata = avector((size_t) nsta * mtper * nyear);
+   for (k = 0; k < nyear; k++)
+      for (j = 0; j < mtper; j++)
+         for (i = 0; i < nsta; i++)
+            DATA(i, j, k) = missing;
+
    /* Read station i.d., elevation, northing (or latitude),
-      and easting (or longitude), and allocate array space for data */
+      and easting (or longitude) */
 
    for (i = 0; i < nsta; i++) {
       if (icoord == 1)
@@ -51,10 +69,6 @@ void readdata()
          fscanf(fpin1, "%s%f%f%f", (char*) &sta[i].id, &sta[i].elev, &sta[i].north,
                 &sta[i].east);
       sta[i].elev /= 1000;
-      sta[i].data = matrix(mtper, nyear);
-      for (j = 0; j < mtper; j++)
-         for (k = 0; k < nyear; k++)
-            sta[i].data[j][k] = missing;
 
       if (icoord == 1) {
 
@@ -92,7 +106,7 @@ void readdata()
    fscanf(fpin1, "%d%d", &year[k], &j);
    j--;
    for (i = 0; i < nsta; i++)
-      fscanf(fpin1, "%f", &sta[i].data[j][k]);
+      fscanf(fpin1, "%f", &DATA(i, j, k));
    while (1) {
       if (fscanf(fpin1, "%d%d", &iyear, &j) == EOF)
          break;
@@ -100,7 +114,7 @@ void readdata()
          year[++k] = iyear;
       j--;
       for (i = 0; i < nsta; i++)
-         fscanf(fpin1, "%f", &sta[i].data[j][k]);
+         fscanf(fpin1, "%f", &DATA(i, j, k));
    }
 
    fclose(fpin1);
@@ -110,7 +124,7 @@ void readdata()
 for (i = 0; i < nsta; i++)
    for (j = 0; j < mtper; j++)
       for (k = 0; k < nyear; k++)
-         sta[i].data[j][k] *= 100.;
+         DATA(i, j, k) *= 100.;
    End experiment */
 
 }
@@ -0,0 +1,263 @@
+/*
+ *    staidx.c
+ *
+ *    Spatial index of stations for neighborhood searches
+ *
+ *    The stations are sorted into a uniform grid of buckets laid over
+ *    their coordinates (eastings and northings, or longitudes and
+ *    latitudes), with about two stations per bucket.  The nearest
+ *    stations to a point are found by visiting the buckets in rings
+ *    around the point until no unvisited bucket can hold a closer
+ *    station, and the stations within a radius by visiting only the
+ *    buckets that overlap the radius.  Distances are computed with
+ *    dist_en() or dist_ll(), exactly as for the grid cell distances in
+ *    the main program, so results agree with a search through all
+ *    stations.
+ *
+ *    staidx_build() must be called once after the station coordinates
+ *    are read; the queries may then be called from any thread.
+ */
+
+#include <malloc/malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "dk_x.h"
+
+#define BIG 1.0e30f              /* larger than any distance */
+
+static int nbx, nby;             /* number of buckets east-west and
+                                    north-south */
+static float bx0, by0;           /* lower left corner of bucket grid */
+static float bw;                 /* width of bucket (coordinate units) */
+static int *bstart = NULL;       /* index in bsta of first station in each
+                                    bucket (nbx*nby + 1) */
+static int *bsta = NULL;         /* station indexes sorted by bucket */
+static float kmx, kmy;           /* minimum km per coordinate unit east-west
+                                    and north-south */
+
+/*
+ *    Distance (km) from a point to station m
+ */
+
+static float stadist(north, east, m)
+float north, east;               /* coordinates of point */
+int m;                           /* station index */
+{
+   float ewdist, nsdist;         /* east-west and north-south distances */
+
+   if (icoord == 1)
+      return(dist_ll(north, east, sta[m].north, sta[m].east, &ewdist,
+                     &nsdist));
+   else
+      return(dist_en(north, east, sta[m].north, sta[m].east));
+}
+
+/*
+ *    Bucket column or row holding coordinate x (clamped to the grid)
+ */
+
+static int bucket(x, x0, nb)
+float x;                         /* coordinate */
+float x0;                        /* coordinate of lower edge of grid */
+int nb;                          /* number of buckets */
+{
+   int i;                        /* bucket index */
+
+   i = (int) floor((x - x0) / bw);
+   if (i < 0)
+      i = 0;
+   if (i > nb - 1)
+      i = nb - 1;
+   return(i);
+}
+
+/*
+ *    Build the index from the station coordinates
+ */
+
+void staidx_build()
+{
+   int b, m;                     /* loop indexes */
+   float xmax, ymax;             /* upper right corner of stations */
+   double area;                  /* area covered by stations */
+
+   bx0 = xmax = sta[0].east;
+   by0 = ymax = sta[0].north;
+   for (m = 1; m < nsta; m++) {
+      if (sta[m].east < bx0)
+         bx0 = sta[m].east;
+      if (sta[m].east > xmax)
+         xmax = sta[m].east;
+      if (sta[m].north < by0)
+         by0 = sta[m].north;
+      if (sta[m].north > ymax)
+         ymax = sta[m].north;
+   }
+
+   /* Bucket width for about two stations per bucket */
+
+   area = (double) (xmax - bx0) * (ymax - by0);
+   if (area > 0)
+      bw = (float) sqrt(area / (nsta / 2. + 1));
+   else if (xmax - bx0 + ymax - by0 > 0)
+      bw = (xmax - bx0 + ymax - by0) / (nsta / 2.f + 1);
+   else
+      bw = 1;
+   nbx = (int) ((xmax - bx0) / bw) + 1;
+   nby = (int) ((ymax - by0) / bw) + 1;
+
+   /* Sort stations into buckets */
+
+   if (bstart != NULL) {
+      free(bstart);
+      free(bsta);
+   }
+   bstart = ivector(nbx * nby + 1);
+   bsta = ivector(nsta);
+   for (b = 0; b <= nbx * nby; b++)
+      bstart[b] = 0;
+   for (m = 0; m < nsta; m++)
+      bstart[bucket(sta[m].north, by0, nby) * nbx +
+             bucket(sta[m].east, bx0, nbx) + 1]++;
+   for (b = 0; b < nbx * nby; b++)
+      bstart[b+1] += bstart[b];
+   for (m = 0; m < nsta; m++) {
+      b = bucket(sta[m].north, by0, nby) * nbx + bucket(sta[m].east, bx0, nbx);
+      bsta[bstart[b]++] = m;
+   }
+   for (b = nbx * nby; b > 0; b--)
+      bstart[b] = bstart[b-1];
+   bstart[0] = 0;
+
+   /* Smallest distance per coordinate unit, for bounding the distance
+      to stations in buckets not yet visited */
+
+   if (icoord == 1)
+      dist_ll_scale(&kmy, &kmx);
+   else
+      kmx = kmy = 0.001f;
+}
+
+/*
+ *    Find the k stations nearest to a point among the stations flagged
+ *    in avail (NULL = all).  On return, idx[0..k-1] holds their indexes
+ *    (in no particular order) and dist[idx[i]] their distances.  idx and
+ *    dist must have room for nsta values.  Returns the number of
+ *    stations found, which is less than k only if fewer are available.
+ */
+
+int staidx_nearest(north, east, k, avail, idx, dist)
+float north, east;               /* coordinates of point */
+int k;                           /* number of stations wanted */
+int *avail;                      /* station availability flags */
+int *idx;                        /* indexes of stations found */
+float *dist;                     /* distances, by station index */
+{
+   int b, i, ix, iy, m;          /* loop indexes */
+   int cx, cy;                   /* bucket holding point */
+   int dx;                       /* step between buckets in ring row */
+   float dk;                     /* distance to kth nearest station */
+   float lim;                    /* least distance to unvisited bucket */
+   int nc;                       /* number of candidate stations */
+   int r, rmax;                  /* ring number and last ring */
+
+   cx = bucket(east, bx0, nbx);
+   cy = bucket(north, by0, nby);
+   rmax = cx;
+   if (nbx - 1 - cx > rmax)
+      rmax = nbx - 1 - cx;
+   if (cy > rmax)
+      rmax = cy;
+   if (nby - 1 - cy > rmax)
+      rmax = nby - 1 - cy;
+
+   nc = 0;
+   for (r = 0; r <= rmax; r++) {
+
+      /* Add stations in the ring of buckets r away from the point */
+
+      for (iy = cy - r; iy <= cy + r; iy++) {
+         if (iy < 0 || iy >= nby)
+            continue;
+         dx = (iy == cy - r || iy == cy + r) ? 1 : 2 * r;
+         for (ix = cx - r; ix <= cx + r; ix += dx) {
+            if (ix < 0 || ix >= nbx)
+               continue;
+            b = iy * nbx + ix;
+            for (i = bstart[b]; i < bstart[b+1]; i++) {
+               m = bsta[i];
+               if (avail == NULL || avail[m] == 1) {
+                  idx[nc++] = m;
+                  dist[m] = stadist(north, east, m);
+               }
+            }
+         }
+      }
+      if (nc < k)
+         continue;
+
+      /* Done when no station outside the rings can be closer than the
+         kth nearest so far */
+
+      lim = BIG;
+      if (cx - r > 0 && (east - (bx0 + (cx - r) * bw)) * kmx < lim)
+         lim = (east - (bx0 + (cx - r) * bw)) * kmx;
+      if (cx + r < nbx - 1 && (bx0 + (cx + r + 1) * bw - east) * kmx < lim)
+         lim = (bx0 + (cx + r + 1) * bw - east) * kmx;
+      if (cy - r > 0 && (north - (by0 + (cy - r) * bw)) * kmy < lim)
+         lim = (north - (by0 + (cy - r) * bw)) * kmy;
+      if (cy + r < nby - 1 && (by0 + (cy + r + 1) * bw - north) * kmy < lim)
+         lim = (by0 + (cy + r + 1) * bw - north) * kmy;
+      selectn(dist, idx, nc, k);
+      dk = 0;
+      for (i = 0; i < k; i++)
+         if (dist[idx[i]] > dk)
+            dk = dist[idx[i]];
+      if (dk <= lim)
+         return(k);
+   }
+   return(nc);
+}
+
+/*
+ *    Find the stations within the given radius (km) of a point among the
+ *    stations flagged in avail (NULL = all).  On return, idx[0..n-1]
+ *    holds their indexes (in no particular order) and dist[idx[i]] their
+ *    distances, where n is the returned count.  idx and dist must have
+ *    room for nsta values.
+ */
+
+int staidx_radius(north, east, radius, avail, idx, dist)
+float north, east;               /* coordinates of point */
+float radius;                    /* search radius (km) */
+int *avail;                      /* station availability flags */
+int *idx;                        /* indexes of stations found */
+float *dist;                     /* distances, by station index */
+{
+   int b, i, ix, iy, m;          /* loop indexes */
+   int ix1, ix2, iy1, iy2;       /* range of buckets to search */
+   int nc;                       /* number of stations found */
+
+   ix1 = bucket(east - radius / kmx, bx0, nbx);
+   ix2 = bucket(east + radius / kmx, bx0, nbx);
+   iy1 = bucket(north - radius / kmy, by0, nby);
+   iy2 = bucket(north + radius / kmy, by0, nby);
+
+   nc = 0;
+   for (iy = iy1; iy <= iy2; iy++) {
+      for (ix = ix1; ix <= ix2; ix++) {
+         b = iy * nbx + ix;
+         for (i = bstart[b]; i < bstart[b+1]; i++) {
+            m = bsta[i];
+            if (avail == NULL || avail[m] == 1) {
+               dist[m] = stadist(north, east, m);
+               if (dist[m] <= radius)
+                  idx[nc++] = m;
+            }
+         }
+      }
+   }
+   return(nc);
+}
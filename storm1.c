@@ -23,6 +23,7 @@
 
 #include <stdio.h>
 
+#include "dk_m.h"
 #include "dk_x.h"
 
 void storm1()
@@ -56,9 +57,9 @@ void storm1()
 			izero = 1;
 			ksta = k5 = 0;
 			for (i = 0; i < nsta; i++) {
-				if (sta[i].data[j][k] > 0.01 && sta[i].data[j][k] < missing)
+				if (DATA(i, j, k) > 0.01 && DATA(i, j, k) < missing)
 					ksta++;
-				if (sta[i].data[j][k] > 5.0 && sta[i].data[j][k] < missing)
+				if (DATA(i, j, k) > 5.0 && DATA(i, j, k) < missing)
 					k5 = 1;
 			}
 			if (ksta >= 3 && k5 == 1) {
@@ -109,9 +110,9 @@ void storm1()
 					kk = storm[nstorm].ystart;
 					dstop = lastday[kk] - 1;
 					for (n = 0; n < storm[nstorm].slen; n++) {
-						if (sta[i].data[jj][kk] < accum)
-							adata[i] += sta[i].data[jj][kk];
-						else if (sta[i].data[jj][kk] > missing) {
+						if (DATA(i, jj, kk) < accum)
+							adata[i] += DATA(i, jj, kk);
+						else if (DATA(i, jj, kk) > missing) {
 							adata[i] = 99999;
 							break;
 						}
@@ -198,8 +199,8 @@ fprintf(fpout, "\nReturning from medfit() ...\nintercept = %f   slope = %f   mae
 							kk = storm[nstorm].ystart;
 							dstop = lastday[kk] - 1;
 							for (n = 0; n < storm[nstorm].slen; n++) {
-								if (sta[i].data[jj][kk] < accum)
-									sta[i].data[jj][kk] -= dum;
+								if (DATA(i, jj, kk) < accum)
+									DATA(i, jj, kk) -= dum;
 								jj++;
 								if (jj > dstop) {
 									jj = 0;
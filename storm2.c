@@ -4,147 +4,370 @@
  *    David Garen  9/92
  *
  *    Compute MAP based on storms.
+ *
+ *    Modification, October 2026:
+ *       Added kriging variance grids, written alongside the estimated
+ *       grids when kriging-variance is set
+ *
+ *    Modification, October 2026:
+ *       Storm days are kriged in parallel, KTBATCH days per thread at a
+ *       time, each into the grids of its thread (tstep.c).  The weights
+ *       for days with missing stations are fetched from the weight cache
+ *       before each batch, and the grids are written out in storm and day
+ *       order.  Zone output is written for every day again (it had ended
+ *       up inside the disabled NETCDF output), and a day with fewer than
+ *       two stations no longer stops the processing of the rest of its
+ *       storm.  On a grid of KGPAR or more used cells, the days are
+ *       kriged one at a time instead, with the grid loop of each day in
+ *       parallel.
+ *
+ *    Modification, October 2026:
+ *       Runs of up to KTRUN consecutive storm days with the same stations
+ *       with data are kriged together, as one product of their weights and
+ *       the residuals of all of the days (tstep_krige())
  */
 
+#include <omp.h>
 #include <stdio.h>
+#include <stdlib.h>
 
+#include "dk_m.h"
 #include "dk_x.h"
 
-void storm2()
-{
-	int i, j, k, l, m, n;         /* loop indexes */
-	int ns;                       /* number of stations with data */
-	int *staflg;				 	 /* station use flags*/
-
-	// set station use flags
-	staflg = ivector(nsta);
-	for (m = 0; m < nsta; m++)
-		staflg[m] = 1;
-
-
-	/* Storm loop */
+/*
+ *    Finish used grid cells u0 to u1-1 of grid t of a run for day j of
+ *    year k of storm m, and return the sum of the estimates of those
+ *    cells used for the spatial average.  The grid already holds the
+ *    kriged residuals (tstep_krige()), except with equal weights, which
+ *    are applied here.
+ */
 
+static float storm2_cells(u0, u1, t, j, k, m, imiss, ns, wmiss, ts)
+int u0, u1;                      /* first and last+1 used grid cells */
+int t;                           /* timestep of run */
+int j;                           /* day */
+int k;                           /* year */
+int m;                           /* storm */
+int imiss;                       /* 1 = one or more stations have missing
+                                    data */
+int ns;                          /* number of stations with data */
+float *wmiss;                    /* kriging weights for stations with data
+                                    (used grid cells x ns) */
+struct tstep *ts;                /* buffers of run */
+{
+	float dum;                    /* sum of grid values */
+	float *g;                     /* estimates at used grid cells */
+	int i, l, u;                  /* loop indexes */
+	float *v;                     /* kriging variances at used grid
+                                    cells */
 
-	for (m = 0; m < nstorm; m++) {
-		if (b0[m][0] <= 99998 && b1[m][0] <= 99998) {
+	g = ts->g + (size_t) t * ngriduse;
+	v = (ivar == 1) ? ts->v + (size_t) t * ngriduse : NULL;
 
-			/* Day loop */
+	dum = 0;
+	for (u = u0; u < u1; u++) {
+		l = iuse[u];
 
-			j = storm[m].dstart;
-			k = storm[m].ystart;
-			dstop = lastday[k] - 1;
-			for (n = 0; n < storm[m].slen; n++) {
-				if (map[j][k] > missing) {
+		/* Compute detrended precipitation at grid cell */
 
-					/* Check to see if any stations have missing data */
-
-					imiss = ns = 0;
-					for (i = 0; i < nsta; i++)
-						if (sta[i].data[j][k] < accum)
-							ns++;
-					if (ns <= 1)
-						continue;
-					if (ns < nsta) {
-						imiss = 1;
-						if (iwt == 2) {
-							for (i = 0; i < nsta; i++) {
-								if (sta[i].data[j][k] < accum)
-									w[i] = 1.0 / ns;
-								else
-									w[i] = 0.0;
-							}
-						}
-					}
+		if (imiss == 1 && iwt != 1) {
+			g[u] = 0;
+			for (i = 0; i < nsta; i++)
+				g[u] += (float) ((ts->w[i] * DATA(i, j, k)));
+		}
 
-					/* Grid loop */
+		/* Kriging variance at grid cell */
 
-					dum = 0;
-					for (l = 0; l < ngrid; l++) {
-						if (grid[l].use == 1) {
+		if (ivar == 1)
+			v[u] = (imiss == 1) ?
+					wmiss[(size_t) ngriduse * ns + u] : wvar[l];
 
-							/* If one or more stations have missing data,
-                        calculate kriging weights excluding those stations;
-                        otherwise, use weights for all stations
-                        that have already been calculated */
+		/* Re-trend grid prec/temp */
 
-							if (iwt == 1 && imiss == 1) {
-								for (i = 0; i < nsta; i++) {
-									if (sta[i].data[j][k] < accum)
-										staflg[i] = 1;
-									else
-										staflg[i] = 0;
-								}
-								krige(l, ns);
-//								w = krige(l, nsta, ad, dgrid, elevations);
-							}
+		g[u] += (b0[m][0] + b1[m][0] * grid[l].elev);
 
-							/* Compute detrended precipitation at grid cell */
+		/* Set grid prec values to zero if estimate is
+		   less than zero */
 
-							gprec[l] = 0;
-							if (imiss == 1) {
-								for (i = 0; i < nsta; i++)
-									gprec[l] += (float) ((w[i] * sta[i].data[j][k]));
-							}
-							else {
-								for (i = 0; i < nsta; i++)
-									gprec[l] += (wall[l][i] * sta[i].data[j][k]);
-							}
+		if (g[u] < 0)
+			g[u] = 0;
 
-							/* Re-trend grid prec/temp */
+		/* Add grid prec to basin sum */
 
-							gprec[l] += (b0[m][0] + b1[m][0] * grid[l].elev);
+		if (imask == 0 || (imask == 1 && grid[l].mask == 1))
+			dum += g[u];
+	}
+	return(dum);
+}
 
-							/* Set grid prec values to zero if estimate is
-                        less than zero */
+/*
+ *    Krige a run of nt storm days, the days tj, years tk, and storms tm
+ *    of which are given, into the grids of the calling thread, one grid
+ *    for each day.  The days of a run have the same stations with data.
+ *    act[t] is set to 1 if day t of the run was kriged, 0 if not.
+ */
 
-							if (gprec[l] < 0)
-								gprec[l] = 0;
+static void storm2_run(nt, tj, tk, tm, wmiss, act, ts)
+int nt;                          /* number of days in run */
+int *tj;                         /* days of run */
+int *tk;                         /* years of days of run */
+int *tm;                         /* storms of days of run */
+float *wmiss;                    /* kriging weights for stations with data
+                                    (used grid cells x ns) */
+int *act;                        /* what was done for each day */
+struct tstep *ts;                /* buffers of calling thread */
+{
+	int b;                        /* block of used grid cells */
+	float dum[KTRUN];             /* sums of grid values */
+	int i, j, k, t;               /* loop indexes */
+	int imiss;                    /* 1 = one or more stations have missing
+	                                 data */
+	int nblk;                     /* number of blocks of used grid cells */
+	int ns;                       /* number of stations with data */
+	int u0, u1;                   /* first and last+1 used grid cells of
+	                                 block */
+
+	for (t = 0; t < nt; t++)
+		act[t] = 0;
+
+	/* Check to see if any stations have missing data (the same for all
+	   of the days of a run) */
+
+	j = tj[0];
+	k = tk[0];
+	imiss = ns = 0;
+	for (i = 0; i < nsta; i++)
+		if (DATA(i, j, k) < accum)
+			ns++;
+	if (ns <= 1)
+		return;
+	if (ns < nsta) {
+		imiss = 1;
+		if (iwt == 2) {
+			for (i = 0; i < nsta; i++) {
+				if (DATA(i, j, k) < accum)
+					ts->w[i] = 1.0 / ns;
+				else
+					ts->w[i] = 0.0;
+			}
+		}
 
-							/* Add grid prec to basin sum */
+		/* If one or more stations have missing data, use kriging
+		   weights excluding those stations (fetched from the weight
+		   cache by storm2()); otherwise, use weights for all stations
+		   that have already been calculated */
 
-							if (imask == 0 || (imask == 1 && grid[l].mask == 1))
-								dum += gprec[l];
-						}
-					}
+		else {
+			ns = 0;
+			for (i = 0; i < nsta; i++)
+				if (DATA(i, j, k) < accum)
+					ts->ista[ns++] = i;
+		}
+	}
 
-					/* If requested, write out grid in GRASS format */
+	/* Residuals of the stations with data, one column for each day of
+	   the run */
+
+	if (imiss == 0 || iwt == 1)
+		for (t = 0; t < nt; t++)
+			for (i = 0; i < ns; i++)
+				ts->r[i * nt + t] =
+						DATA((imiss == 1) ? ts->ista[i] : i, tj[t], tk[t]);
+
+	/* Grid loop; on a large grid, blocks of used grid cells are kriged
+	   in parallel and their sums added in block order, so that the
+	   result does not depend on the number of threads */
+
+	if (ngriduse < KGPAR) {
+		if (imiss == 0 || iwt == 1)
+			tstep_krige(ts, nt, ns, (imiss == 1) ? wmiss : NULL, 0, ngriduse,
+					0);
+		for (t = 0; t < nt; t++)
+			dum[t] = storm2_cells(0, ngriduse, t, tj[t], tk[t], tm[t], imiss,
+					ns, wmiss, ts);
+	}
+	else {
+		nblk = (ngriduse + KGBLK - 1) / KGBLK;
+#pragma omp parallel for schedule(static) private(t, u0, u1)
+		for (b = 0; b < nblk; b++) {
+			u0 = b * KGBLK;
+			u1 = (b + 1 < nblk) ? u0 + KGBLK : ngriduse;
+			if (imiss == 0 || iwt == 1)
+				tstep_krige(ts, nt, ns, (imiss == 1) ? wmiss : NULL, u0, u1,
+						0);
+			for (t = 0; t < nt; t++)
+				ts->bs[b * nt + t] = storm2_cells(u0, u1, t, tj[t], tk[t],
+						tm[t], imiss, ns, wmiss, ts);
+		}
+		for (t = 0; t < nt; t++) {
+			dum[t] = 0;
+			for (b = 0; b < nblk; b++)
+				dum[t] += ts->bs[b * nt + t];
+		}
+	}
 
-					if (iout == 2 && j >= igridout1 && j <= igridout2)
-						grassout(year[k], j);
+	/* Compute MAP for day */
 
-					/* If requested, write out grid in ARC/INFO format */
+	for (t = 0; t < nt; t++) {
+		if (imask == 0)
+			map[tj[t]][tk[t]] = dum[t] / ngriduse;
+		else
+			map[tj[t]][tk[t]] = dum[t] / nmask;
+		act[t] = 1;
+	}
+}
 
-					if (iout == 3 && j >= igridout1 && j <= igridout2)
-						arcout(year[k], j);
+void storm2()
+{
+	int *act;                     /* 1 = day of batch was kriged */
+	int i, j, k, m, n, r;         /* loop indexes */
+	int nb;                       /* number of days in a batch */
+	int nr;                       /* number of runs in batch */
+	int ns;                       /* number of stations with data */
+	int nt;                       /* number of storm days to krige */
+	int *rn, *rt;                 /* number of days and first day of each
+	                                 run */
+	int *staflg;                  /* station use flags */
+	int t, t0, t1;                /* day counter, and first and last+1
+	                                 days of batch */
+	int *tkind;                   /* weights of each day of batch, for runs
+	                                 (0 = none, 1 = all stations, 2 =
+	                                 stations with data) */
+	int *tj, *tk, *tm;            /* day, year, and storm of each day to
+	                                 krige */
+	struct tstep *ts;             /* buffers of thread */
+	float **wday;                 /* kriging weights for days with missing
+	                                 stations, by day of batch */
 
-					/* If requested, write out grid in IPW format */
+	// set station use flags
+	staflg = ivector(nsta);
+	for (m = 0; m < nsta; m++)
+		staflg[m] = 1;
+	nb = KTBATCH * KTRUN * omp_get_max_threads();
+	wday = (float **) malloc(nb * sizeof(float *));
+	if (!wday) {
+		printf("\n\nAllocation failure in storm2().\n");
+		exit(0);
+	}
+	for (t = 0; t < nb; t++)
+		wday[t] = NULL;
+	act = ivector(nb);
+	rn = ivector(nb);
+	rt = ivector(nb);
+	tkind = ivector(nb);
+
+	/* Storm days to krige: those of storms with valid detrending
+	   coefficients that have not been set to zero */
+
+	nt = 0;
+	for (m = 0; m < nstorm; m++)
+		nt += storm[m].slen;
+	tj = ivector(nt + 1);
+	tk = ivector(nt + 1);
+	tm = ivector(nt + 1);
+	nt = 0;
+	for (m = 0; m < nstorm; m++) {
+		if (b0[m][0] <= 99998 && b1[m][0] <= 99998) {
+			j = storm[m].dstart;
+			k = storm[m].ystart;
+			dstop = lastday[k] - 1;
+			for (n = 0; n < storm[m].slen; n++) {
+				if (map[j][k] > missing) {
+					tj[nt] = j;
+					tk[nt] = k;
+					tm[nt++] = m;
+				}
+				j++;
+				if (j > dstop) {
+					j = 0;
+					k++;
+				}
+			}
+		}
+	}
 
-					if (iout == 4 && j >= igridout1 && j <= igridout2)
-						ipwout(year[k], j);
+	/* Day loop, a batch of days at a time */
 
-					/* If requested, write out grid in NETCDF format */
+	for (t0 = 0; t0 < nt; t0 = t1) {
+		t1 = (t0 + nb < nt) ? t0 + nb : nt;
 
-					if (iout == 5 && j >= igridout1 && j <= igridout2)
-//						netcdfout(year[k], j, gprec, arc.cols, arc.rows);
+		/* Get kriging weights for the days of the batch with missing
+		   stations (calculated once for each pattern of missing
+		   stations).  The batch ends with the day of a weight set that
+		   is not held in the cache, so that such sets are freed as soon
+		   as they have been used. */
 
-					/* If requested, compute and write out zonal means for day */
+		for (t = t0; t < t1; t++) {
+			ns = 0;
+			for (i = 0; i < nsta; i++) {
+				staflg[i] = (DATA(i, tj[t], tk[t]) < accum);
+				ns += staflg[i];
+			}
+			tkind[t-t0] = (ns == nsta) ? 1 : 0;
+			if (ns > 1 && ns < nsta && iwt != 2) {
+				wday[t-t0] = kwcache_get(staflg, ns);
+				tkind[t-t0] = 2;
+				if (kwcache_held(wday[t-t0]) == 0)
+					t1 = t + 1;
+			}
+		}
 
-					if (izone == 1)
-						zoneout(year[k], j);
+		/* Runs of days with the same weights */
 
-					/* Compute MAP for day */
+		nr = 0;
+		for (t = 0; t < t1 - t0; t++) {
+			if (nr > 0 && tkind[t] != 0 && rn[nr-1] < KTRUN &&
+					tkind[t] == tkind[rt[nr-1]] && wday[t] == wday[rt[nr-1]])
+				rn[nr-1]++;
+			else {
+				rt[nr] = t;
+				rn[nr++] = 1;
+			}
+		}
 
-					if (imask == 0)
-						map[j][k] = dum / ngriduse;
-					else
-						map[j][k] = dum / nmask;
-				}
-				j++;
-				if (j > dstop) {
-					j = 0;
-					k++;
+		/* Krige the runs of the batch in parallel, and write out the
+		   grids in storm and day order */
+
+#pragma omp parallel for ordered schedule(dynamic) private(i, t, ts) \
+	if(ngriduse < KGPAR)
+		for (r = 0; r < nr; r++) {
+			t = rt[r];
+			ts = tstep_get(0);
+			storm2_run(rn[r], tj + t0 + t, tk + t0 + t, tm + t0 + t, wday[t],
+					act + t, ts);
+#pragma omp ordered
+			{
+
+				/* If requested, write out grids in GRASS, ARC/INFO, or IPW
+				   format, and compute and write out zonal means for day */
+
+				for (i = 0; i < rn[r]; i++) {
+					if (act[t+i] == 1) {
+						tstep_write(year[tk[t0+t+i]], tj[t0+t+i],
+								ts->g + (size_t) i * ngriduse, (ivar == 1) ?
+								ts->v + (size_t) i * ngriduse : NULL);
+						if (izone == 1)
+							zoneout(year[tk[t0+t+i]], tj[t0+t+i], 1,
+									ts->g + (size_t) i * ngriduse);
+					}
 				}
 			}
 		}
+
+		for (t = 0; t < t1 - t0; t++) {
+			if (wday[t] != NULL) {
+				kwcache_release(wday[t]);
+				wday[t] = NULL;
+			}
+		}
 	}
+	free(act);
+	free(rn);
+	free(rt);
+	free(staflg);
+	free(tj);
+	free(tk);
+	free(tkind);
+	free(tm);
+	free(wday);
 }
@@ -16,6 +16,7 @@
 
 #include <stdio.h>
 
+#include "dk_m.h"
 #include "dk_x.h"
 
 void swe1()
@@ -76,8 +77,8 @@ void swe1()
             adata[i] = 0;
             for (n = 0; n < nstop; n++) {
                j = jj + n;
-               if (sta[i].data[j][k] < missing)
-                  adata[i] += sta[i].data[j][k];
+               if (DATA(i, j, k) < missing)
+                  adata[i] += DATA(i, j, k);
                else {
                   adata[i] = 99999;
                   break;
@@ -95,7 +96,7 @@ void swe1()
             izero = 1;
             for (i = 0; i < nsta; i++) {
                if (adata[i] <= 99998) {
-                  if (sta[i].data[j][k] > 0.001) {
+                  if (DATA(i, j, k) > 0.001) {
                      izero = 0;
                      break;
                   }
@@ -218,8 +219,8 @@ printf("\nPeriod %d: medfit slope = %f", m+1, b1dum);
                      dum = b0[m][k] + b1[m][k] * sta[i].elev;
                   for (n = 0; n < nstop; n++) {
                      j = jj + n;
-                     if (map[j][k] > missing && sta[i].data[j][k] < missing)
-                        sta[i].data[j][k] -= dum;
+                     if (map[j][k] > missing && DATA(i, j, k) < missing)
+                        DATA(i, j, k) -= dum;
                   }
                }
             }
@@ -0,0 +1,182 @@
+/*
+ *    tstep.c
+ *
+ *    Grid buffers for kriging timesteps in parallel
+ *
+ *    period2(), swe2(), and storm2() krige several runs of timesteps at
+ *    once, one per thread.  A run is up to KTRUN consecutive timesteps
+ *    with the same stations with data, and so the same kriging weights;
+ *    the weights times the residuals of all of its timesteps are one
+ *    matrix product (tstep_krige()).  Each thread keeps its own estimate
+ *    and kriging variance grids and work vectors for the rest of the
+ *    program run, allocated the first time it needs them.  The grids of
+ *    a timestep are written out by the thread that computed them, in
+ *    timestep order, so that the output files are the same as those of
+ *    a serial run.  On a large grid the runs are kriged one at a time
+ *    instead, each with its grid loop in parallel, and only the first
+ *    thread's buffers are used.
+ *
+ *    The grids of the buffers hold the used grid cells only, in the
+ *    order of iuse, so that their size does not depend on how much of
+ *    the raster is masked out.  They are scattered into one raster grid
+ *    (tstep_full()) to be written out.
+ */
+
+#include <malloc/malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "dk_m.h"
+#include "dk_x.h"
+
+#define TSROW 256                /* number of used grid cells multiplied
+                                    at a time by tstep_krige() */
+
+static struct tstep tsspace;        /* buffers of this thread */
+static struct tstep *ts = NULL;     /* pointer to buffers (NULL until
+                                       allocated) */
+#pragma omp threadprivate(tsspace, ts)
+static float *gfull = NULL;         /* raster grid for output, shared by
+                                       the threads (NULL until
+                                       allocated) */
+
+/*
+ *    Return the buffers of the calling thread, with room for copies of
+ *    the grids of at least nday days.  The grids are zero when first
+ *    allocated.
+ */
+
+struct tstep *tstep_get(nday)
+int nday;                        /* number of days in gd and vd */
+{
+	int i;                        /* loop index */
+
+	if (ts == NULL) {
+		tsspace.g = vector(KTRUN * ngriduse);
+		tsspace.v = (ivar == 1) ? vector(KTRUN * ngriduse) : NULL;
+		for (i = 0; i < KTRUN * ngriduse; i++) {
+			tsspace.g[i] = 0;
+			if (ivar == 1)
+				tsspace.v[i] = 0;
+		}
+		tsspace.nday = 0;
+		tsspace.gd = tsspace.vd = NULL;
+		tsspace.r = vector(nsta * KTRUN);
+		tsspace.w = dvector(nsta);
+		tsspace.ista = ivector(nsta);
+		tsspace.bs = vector((ngriduse / KGBLK + 1) * KTRUN);
+		tsspace.zm = (izone == 1) ? vector(KTRUN * nzone) : NULL;
+		ts = &tsspace;
+	}
+	if (nday > ts->nday) {
+		if (ts->gd != NULL)
+			free(ts->gd);
+		if (ts->vd != NULL)
+			free(ts->vd);
+		ts->gd = vector(nday * ngriduse);
+		ts->vd = (ivar == 1) ? vector(nday * ngriduse) : NULL;
+		if (ts->zm != NULL) {
+			free(ts->zm);
+			ts->zm = vector((nday + KTRUN) * nzone);
+		}
+		ts->nday = nday;
+	}
+	return(ts);
+}
+
+/*
+ *    Kriged residuals at used grid cells u0 to u1-1 for the nt timesteps
+ *    of a run: grid t of g gets the weights times the residuals in
+ *    column t of r.  With all stations the weights are those of wall,
+ *    otherwise those of wmiss; either way the weights of consecutive
+ *    used grid cells are consecutive rows of one block.  If acc is 1 the
+ *    products are added to the grid values already there, otherwise to
+ *    zero.  The weights of TSROW cells at a time are multiplied by the
+ *    residuals of all of the timesteps (smatmul()), so that each weight
+ *    is read once for the run rather than once for each timestep;
+ *    without USE_LAPACK the sums are the same as those of one timestep
+ *    at a time.
+ */
+
+void tstep_krige(ts, nt, ns, wmiss, u0, u1, acc)
+struct tstep *ts;                /* buffers of run */
+int nt;                          /* number of timesteps in run */
+int ns;                          /* number of stations with data */
+float *wmiss;                    /* kriging weights for stations with data
+                                    (used grid cells x ns), or NULL for
+                                    all stations */
+int u0, u1;                      /* first and last+1 used grid cells */
+int acc;                         /* 1 = add to grid values */
+{
+	float c[TSROW * KTRUN];       /* products for a block of cells */
+	float *g;                     /* grid of timestep */
+	int i, t, u;                  /* loop indexes */
+	int n;                        /* number of cells in block */
+	int ub;                       /* first cell of block */
+	float *wb;                    /* weights of cells in block */
+
+	for (ub = u0; ub < u1; ub += TSROW) {
+		n = (ub + TSROW < u1) ? TSROW : u1 - ub;
+		wb = (wmiss == NULL) ? wall[iuse[ub]] : wmiss + (size_t) ub * ns;
+		for (i = 0; i < n; i++) {
+			u = ub + i;
+			for (t = 0; t < nt; t++)
+				c[i * nt + t] = (acc == 1) ? ts->g[(size_t) t * ngriduse + u] : 0;
+		}
+		smatmul(n, nt, ns, wb, ts->r, c);
+		for (t = 0; t < nt; t++) {
+			g = ts->g + (size_t) t * ngriduse + ub;
+			for (i = 0; i < n; i++)
+				g[i] = c[i * nt + t];
+		}
+	}
+}
+
+/*
+ *    Return the raster grid of the values g at the used grid cells, with
+ *    zero at the other cells.  The raster grid is shared by the threads
+ *    and overwritten by the next call, so it is only used where the
+ *    grids are written out, one timestep at a time.
+ */
+
+float *tstep_full(g)
+float *g;                        /* values at used grid cells */
+{
+	int i, u;                     /* loop indexes */
+
+	if (gfull == NULL) {
+		gfull = vector(ngrid);
+		for (i = 0; i < ngrid; i++)
+			gfull[i] = 0;
+	}
+	for (u = 0; u < ngriduse; u++)
+		gfull[iuse[u]] = g[u];
+	return(gfull);
+}
+
+/*
+ *    If requested, write out the grids of day (period) ip of year iy in
+ *    GRASS, ARC/INFO, or IPW format
+ */
+
+void tstep_write(iy, ip, g, v)
+int iy;                          /* year */
+int ip;                          /* period (sequential number beginning Oct 1) */
+float *g;                        /* estimates at used grid cells */
+float *v;                        /* kriging variances at used grid cells */
+{
+	if (ip < igridout1 || ip > igridout2)
+		return;
+	if (iout == 2)
+		grassout(iy, ip, tstep_full(g));
+	else if (iout == 3) {
+		arcout(iy, ip, tstep_full(g), 0);
+		if (ivar == 1)
+			arcout(iy, ip, tstep_full(v), 1);
+	}
+	else if (iout == 4) {
+		ipwout(iy, ip, tstep_full(g), 0);
+		if (ivar == 1)
+			ipwout(iy, ip, tstep_full(v), 1);
+	}
+}
@@ -0,0 +1,227 @@
+/*
+ *    xvalid.c
+ *
+ *    Leave-one-out cross-validation of the detrended residuals (-x switch)
+ *
+ *    For each timestep that would be kriged, each station with data is
+ *    withheld in turn and estimated from the other stations with data.
+ *    Instead of solving a kriging system for every withheld station, the
+ *    errors follow from one inverse B of the bordered kriging matrix of
+ *    the stations with data (Dubrule, 1983):
+ *
+ *       z(i) - z*(i) = (B*z)(i) / B(i,i)
+ *
+ *    where z holds the residuals of the stations with data followed by
+ *    a zero.  The inverse depends only on which stations have data, so
+ *    it is computed again only when that changes.  The estimates are
+ *    those of ordinary kriging with all of the other stations, without
+ *    N-closest-stations, search-radius-km, or the elimination of
+ *    stations with negative weights.  With equal station weighting, the
+ *    estimate is the mean of the other stations.
+ *
+ *    Errors are written to the main output file for each timestep and
+ *    summarized for each station.
+ */
+
+#include <malloc/malloc.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "dk_m.h"
+#include "dk_x.h"
+
+static double *xvb = NULL;          /* inverse of bordered kriging matrix
+                                       (row i starts at xvb[i*(ns+1)]) */
+static double *xva;                 /* LU decomposition of bordered matrix */
+static int *xvindx;                 /* row permutation from pivoting */
+static double *xvvv;                /* scratch space for ludcmp() */
+static double *xvz;                 /* residuals of stations with data */
+static int *xvsta;                  /* indexes of stations with data */
+static int *xvlast;                 /* stations with data for current
+                                       inverse (1 = data, 0 = none) */
+static int xvok;                    /* 1 = current inverse is valid */
+static double *xvsum;               /* sum of errors by station */
+static double *xvsum2;              /* sum of squared errors by station */
+static double *xvabs;               /* sum of absolute errors by station */
+static int *xvn;                    /* number of errors by station */
+
+/*
+ *    Cross-validate the residuals of timestep j of year k
+ */
+
+static void xvalid_step(j, k)
+int j;                           /* timestep */
+int k;                           /* year */
+{
+	double bias;                  /* mean error of timestep */
+	float d;                      /* +/- 1 from ludcmp() (not used) */
+	double e;                     /* error of withheld station */
+	int i, m;                     /* loop indexes */
+	int ludcmp();                 /* lu decomposition function */
+	void lubksbm();               /* lu backsubstitution, many r.h.s. */
+	int nchg;                     /* 1 = stations with data have changed */
+	int ns;                       /* number of stations with data */
+	int nsp1;                     /* ns plus 1 */
+	double rmse;                  /* root mean square error of timestep */
+	double s;                     /* sum of residuals (equal weighting) */
+
+	if (map[j][k] <= missing)
+		return;
+	ns = 0;
+	nchg = 0;
+	for (i = 0; i < nsta; i++) {
+		m = (DATA(i, j, k) < accum);
+		if (m != xvlast[i])
+			nchg = 1;
+		xvlast[i] = m;
+		if (m == 1) {
+			xvsta[ns] = i;
+			xvz[ns++] = DATA(i, j, k);
+		}
+	}
+	if (ns <= 2)
+		return;
+	nsp1 = ns + 1;
+
+	/* Inverse of the bordered kriging matrix for the stations with data */
+
+	if (iwt == 1 && (nchg == 1 || xvok == 0)) {
+		for (i = 0; i < ns; i++) {
+			for (m = 0; m < ns; m++)
+				xva[i * nsp1 + m] = ad[xvsta[i]][xvsta[m]];
+			xva[i * nsp1 + ns] = xva[ns * nsp1 + i] = 1;
+		}
+		xva[ns * nsp1 + ns] = 0;
+		xvok = (ludcmp(xva, nsp1, nsp1, xvindx, &d, xvvv) == 0);
+		if (xvok == 1) {
+			for (i = 0; i < nsp1 * nsp1; i++)
+				xvb[i] = 0;
+			for (i = 0; i < nsp1; i++)
+				xvb[i * nsp1 + i] = 1;
+			lubksbm(xva, nsp1, nsp1, xvindx, xvb, nsp1);
+		}
+	}
+	if (iwt == 1 && xvok == 0) {
+		fprintf(fpout, "%6d%6d  Indeterminate linear system\n", year[k], j+1);
+		return;
+	}
+
+	/* Errors of the withheld stations */
+
+	s = 0;
+	for (i = 0; i < ns; i++)
+		s += xvz[i];
+	bias = rmse = 0;
+	for (i = 0; i < ns; i++) {
+		if (iwt == 1) {
+			e = 0;
+			for (m = 0; m < ns; m++)
+				e += xvb[i * nsp1 + m] * xvz[m];
+			e /= xvb[i * nsp1 + i];
+		}
+		else
+			e = xvz[i] - (s - xvz[i]) / (ns - 1);
+		bias += e;
+		rmse += e * e;
+		m = xvsta[i];
+		xvsum[m] += e;
+		xvsum2[m] += e * e;
+		xvabs[m] += fabs(e);
+		xvn[m]++;
+	}
+	bias /= ns;
+	rmse = sqrt(rmse / ns);
+	fprintf(fpout, "%6d%6d%6d%12.4f%12.4f\n", year[k], j+1, ns, bias, rmse);
+}
+
+void xvalid()
+{
+	int i, j, k, m, n;            /* loop indexes */
+	int np;                       /* number of periods in year */
+	int nsp1;                     /* nsta plus 1 */
+
+	nsp1 = nsta + 1;
+	xvb = dvector(nsp1 * nsp1);
+	xva = dvector(nsp1 * nsp1);
+	xvindx = ivector(nsp1);
+	xvvv = dvector(nsp1);
+	xvz = dvector(nsta);
+	xvsta = ivector(nsta);
+	xvlast = ivector(nsta);
+	xvsum = dvector(nsta);
+	xvsum2 = dvector(nsta);
+	xvabs = dvector(nsta);
+	xvn = ivector(nsta);
+	for (i = 0; i < nsta; i++) {
+		xvlast[i] = 0;
+		xvsum[i] = xvsum2[i] = xvabs[i] = 0;
+		xvn[i] = 0;
+	}
+	xvok = 0;
+
+	fprintf(fpout, "\n\nLeave-one-out cross-validation of detrended residuals");
+	if (iwt == 1)
+		fprintf(fpout, "\n(ordinary kriging with all other stations):\n\n");
+	else
+		fprintf(fpout, "\n(equal weighting of all other stations):\n\n");
+	fprintf(fpout, "  Year Period    N   Mean error        RMSE\n");
+
+	/* Timesteps with valid detrending coefficients, as in storm2(),
+	   swe2(), and period2() */
+
+	if (istorm == 1) {
+		for (m = 0; m < nstorm; m++) {
+			if (b0[m][0] > 99998 || b1[m][0] > 99998)
+				continue;
+			j = storm[m].dstart;
+			k = storm[m].ystart;
+			for (n = 0; n < storm[m].slen; n++) {
+				xvalid_step(j, k);
+				j++;
+				if (j > lastday[k] - 1) {
+					j = 0;
+					k++;
+				}
+			}
+		}
+	}
+	else {
+		for (k = 0; k < nyear; k++) {
+			np = (lastday[k] - firstday[k] + 1) / dpp;
+			for (j = firstday[k] - 1; j < lastday[k]; j++) {
+				m = (j - firstday[k] + 1) / dpp;
+				if (m > np - 1)
+					m = np - 1;
+				if (b0[m][k] <= 99998 && b1[m][k] <= 99998)
+					xvalid_step(j, k);
+			}
+		}
+	}
+
+	/* Summary by station */
+
+	fprintf(fpout, "\n\nLeave-one-out errors by station:\n\n");
+	fprintf(fpout, "%-26s     N   Mean error        RMSE         MAE\n",
+			"Station");
+	for (i = 0; i < nsta; i++) {
+		if (xvn[i] == 0)
+			fprintf(fpout, "%-26s%6d\n", sta[i].id, 0);
+		else
+			fprintf(fpout, "%-26s%6d%12.4f%12.4f%12.4f\n", sta[i].id, xvn[i],
+					xvsum[i] / xvn[i], sqrt(xvsum2[i] / xvn[i]),
+					xvabs[i] / xvn[i]);
+	}
+
+	free(xvb);
+	free(xva);
+	free(xvindx);
+	free(xvvv);
+	free(xvz);
+	free(xvsta);
+	free(xvlast);
+	free(xvsum);
+	free(xvsum2);
+	free(xvabs);
+	free(xvn);
+}
@@ -16,6 +16,17 @@
  *    Modification, 28 November 2012:
  *       Changed order of zone output to be in numerical order, using
  *       zoneseq array to indicate array index for ordering
+ *
+ *    Modification, October 2026:
+ *       The grid to average is passed in, since timesteps are kriged in
+ *       parallel into grids of their own
+ *
+ *    Modification, October 2026:
+ *       The grid is NULL when the caller has already put the zonal means
+ *       in zone[].mean (period2.c, table output only)
+ *
+ *    Modification, October 2026:
+ *       The grid holds the used grid cells only, in the order of iuse
  */
 
 #include <stdio.h>
@@ -23,28 +34,32 @@
 
 #include "dk_x.h"
 
-void zoneout(iy, id, iz)
+void zoneout(iy, id, iz, g)
 int iy;                          /* year */
 int id;                          /* day (sequential number beginning Oct 1) */
 int iz;                          /* zero flag (0 = all values are zero */
+float *g;                        /* values at used grid cells (NULL = zonal
+                                    means already set) */
 {
    void caldate();               /* julian day to calendar day conversion function */
    int day;                      /* day of month */
-   int i, j;                     /* loop indexes */
+   int i, j, u;                  /* loop indexes */
    int month;                    /* calendar month number */
 
    /* Set all zonal mean values to zero */
 
-   for (j = 0; j < nzone; j++)
-      zone[j].mean = 0.0;
+   if (g != NULL || iz == 0)
+      for (j = 0; j < nzone; j++)
+         zone[j].mean = 0.0;
 
    /* Compute zonal means if input not all zero */
 
-   if (iz != 0) {
-      for (i = 0; i < ngrid; i++) {
+   if (g != NULL && iz != 0) {
+      for (u = 0; u < ngriduse; u++) {
+         i = iuse[u];
          for (j = 0; j < nzone; j++) {
             if (grid[i].zone == zone[j].number)
-               zone[j].mean += gprec[i];
+               zone[j].mean += g[u];
          }
       }
 